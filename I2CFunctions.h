@@ -5,23 +5,160 @@
 #include <Wire.h>
 
 #define STOP_CONDITION_I2C true
+
+// Longest transaction in µs, longer than the clock stretching of the lasers.
+// Wire aborts it (cores with WIRE_HAS_TIMEOUT) and the bus is cleared
+#define I2C_TIMEOUT_US            25000
+// Error codes added to the endTransmission ones (0 to 4)
+#define I2C_ERROR_TIMEOUT         5   // The transaction timed out (bus stuck)
+#define I2C_ERROR_SHORT_READ      6   // Fewer bytes received than requested
+// Bus clear, SCL pulses to free a slave holding SDA low, and longest wait for
+// a slave stretching SCL (µs)
+#define I2C_CLEAR_PULSES          9
+#define I2C_CLEAR_STRETCH_US      1000
+
+// Queue I2C transactions instead of blocking the caller, see processQueue()
+// Wire owns the TWI interrupt, the queue is drained cooperatively by the loop
+#ifndef ENABLE_I2C_QUEUE
+#define ENABLE_I2C_QUEUE          false
+#endif
+// Pending transactions ring, has to be a power of 2 (one slot is kept free)
+#define I2C_QUEUE_SIZE            16
+// Maximum number of bytes carried by a queued transaction
+#define I2C_TRANSACTION_LENGTH    4
+// Maximum number of transactions executed per processQueue() call
+#define I2C_QUEUE_BUDGET          4
+
+// Count the transactions, their time and their errors (I2CFunctions::statistics)
+#ifndef ENABLE_STATISTICS
+#define ENABLE_STATISTICS         false
+#endif
+// Errors are counted by endTransmission code (0 is success)
+#define I2C_ERROR_CODES           8
+
+enum I2C_TRANSACTION_TYPE {
+  I2C_WRITE = 0,  // write()
+  I2C_READ = 1,   // readByte(), readWord(), readBlock()
+  I2C_PROBE = 2   // isOnline()
+};
+
+struct I2CStatistics {
+  uint32_t count[3];  // Transactions, by I2C_TRANSACTION_TYPE
+  uint32_t time[3];   // µs spent in the transactions, by I2C_TRANSACTION_TYPE
+  uint16_t errors[I2C_ERROR_CODES]; // Errors, by endTransmission code (and I2C_ERROR_*)
+  uint16_t clears;    // Bus clears, see I2CFunctions::clearBus
+
+  void record(I2C_TRANSACTION_TYPE type, unsigned long start, uint8_t error){
+    count[type]++;
+    time[type] += micros() - start;
+    if(error)
+      errors[error < I2C_ERROR_CODES ? error : I2C_ERROR_CODES - 1]++;
+  };
+
+  void reset(){
+    memset(this, 0, sizeof(I2CStatistics));
+  };
+};
+
+struct I2CTransaction;
+typedef void (*I2CCallback)(I2CTransaction * transaction);
+
+struct I2CTransaction {
+  uint8_t device;   // The I2C device address
+  uint8_t regAdr;   // The I2C foreign register
+  uint8_t length;   // Number of bytes to read, 0 to write data[0]
+  uint8_t nack;     // The nack packet, once executed
+  uint8_t tag;      // Free for the caller (the controller stores the laser id)
+  uint8_t data[I2C_TRANSACTION_LENGTH];
+  void * context;   // Free for the caller, given back to the callback
+  I2CCallback callback;
+};
+
+/*******************************************************************************
+  I2CFunctions : an I2C bus, bound to one TwoWire instance (Wire by default)
+
+  The global I2C is the Wire bus, declare one I2CFunctions per other bus:
+    I2CFunctions I2C1(Wire1);
+  and give its pins (setPins) to be able to clear it.
+
+  Every transaction is bounded: Wire aborts it after I2C_TIMEOUT_US on the
+  cores with WIRE_HAS_TIMEOUT, the others check SDA before each transaction.
+  A slave holding SDA low (a laser power cycled in the middle of a
+  transaction) is freed by clearBus().
+*******************************************************************************/
 class I2CFunctions {
   public:
-  	I2CFunctions() {};
+#if defined(PIN_WIRE_SDA) && defined(PIN_WIRE_SCL)
+  	I2CFunctions() : wire(&Wire), sdaPin(PIN_WIRE_SDA), sclPin(PIN_WIRE_SCL) {};
+#else
+  	I2CFunctions() : wire(&Wire) {};
+#endif
+  	I2CFunctions(TwoWire & _wire) : wire(&_wire) {};
 /*******************************************************************************
   begin : Begin the I2C master device
 
   If fasti2c is true, use 400kHz I2C
 *******************************************************************************/
     void begin(bool fasti2c = false){
-      Wire.begin();
+      fast = fasti2c;
+      wire->begin();
       if (fasti2c) {
       #if ARDUINO >= 157
-          Wire.setClock(400000UL); // Set I2C frequency to 400kHz, for the Due
+          wire->setClock(400000UL); // Set I2C frequency to 400kHz, for the Due
       #else
           TWBR = ((F_CPU / 400000UL) - 16) / 2; // Set I2C frequency to 400kHz
       #endif
       }
+    #ifdef WIRE_HAS_TIMEOUT
+      // Reset the TWI hardware on timeout, the bus is cleared by check()
+      wire->setWireTimeout(I2C_TIMEOUT_US, true);
+    #endif
+    };
+
+/*******************************************************************************
+  setPins : SDA and SCL pins of the bus, to clear it (the pins of Wire are
+  known on most cores)
+*******************************************************************************/
+    void setPins(uint8_t sda, uint8_t scl){
+      sdaPin = sda;
+      sclPin = scl;
+    };
+
+/*******************************************************************************
+  clearBus : Free a slave holding SDA low, up to I2C_CLEAR_PULSES clock pulses
+  then a STOP condition, and start Wire again. Waits for a stretched SCL at
+  most I2C_CLEAR_STRETCH_US per pulse, about 100µs if no slave stretches.
+
+  returns true if SDA is released (false if the pins are unknown)
+*******************************************************************************/
+    bool clearBus(){
+      if(sdaPin == 0xff or sclPin == 0xff)
+        return false;
+#if ENABLE_STATISTICS
+      statistics.clears++;
+#endif
+      wire->end();
+      // Open drain: low is OUTPUT and LOW, high is released to the pull-up
+      pinMode(sdaPin, INPUT_PULLUP);
+      pinMode(sclPin, INPUT_PULLUP);
+      for(uint8_t i = 0; i < I2C_CLEAR_PULSES and digitalRead(sdaPin) == LOW; i++){
+        digitalWrite(sclPin, LOW);
+        pinMode(sclPin, OUTPUT);
+        delayMicroseconds(5);
+        pinMode(sclPin, INPUT_PULLUP);
+        unsigned long start = micros();
+        while(digitalRead(sclPin) == LOW and micros() - start < I2C_CLEAR_STRETCH_US);
+        delayMicroseconds(5);
+      }
+      // STOP: SDA rises while SCL is high
+      digitalWrite(sdaPin, LOW);
+      pinMode(sdaPin, OUTPUT);
+      delayMicroseconds(5);
+      pinMode(sdaPin, INPUT_PULLUP);
+      delayMicroseconds(5);
+      bool released = digitalRead(sdaPin) == HIGH;
+      begin(fast);
+      return released;
     };
 
 
@@ -32,8 +169,18 @@ class I2CFunctions {
           flse if offline
 *******************************************************************************/
     bool isOnline(uint8_t Device = 0x62){
-      Wire.beginTransmission(Device);
-      if(Wire.endTransmission(STOP_CONDITION_I2C))
+      if(!guard())
+        return false;
+#if ENABLE_STATISTICS
+      unsigned long start = micros();
+#endif
+      wire->beginTransmission(Device);
+      uint8_t nackCatcher = check(wire->endTransmission(STOP_CONDITION_I2C));
+#if ENABLE_STATISTICS
+      // Offline devices are expected while probing, they are not errors
+      statistics.record(I2C_PROBE, start, 0);
+#endif
+      if(nackCatcher)
         return false;
       return true;
     };
@@ -64,10 +211,18 @@ class I2CFunctions {
   returns the nack packet
 *******************************************************************************/
     uint8_t write(uint8_t Device, uint8_t regAdr, uint8_t data){
-      Wire.beginTransmission(Device);
-      Wire.write(regAdr);
-      Wire.write(data);
-      uint8_t nackCatcher = Wire.endTransmission(STOP_CONDITION_I2C);
+      if(!guard())
+        return I2C_ERROR_TIMEOUT;
+#if ENABLE_STATISTICS
+      unsigned long start = micros();
+#endif
+      wire->beginTransmission(Device);
+      wire->write(regAdr);
+      wire->write(data);
+      uint8_t nackCatcher = check(wire->endTransmission(STOP_CONDITION_I2C));
+#if ENABLE_STATISTICS
+      statistics.record(I2C_WRITE, start, nackCatcher);
+#endif
       return nackCatcher;
     };
 
@@ -81,12 +236,7 @@ class I2CFunctions {
   returns the nack packet
 *******************************************************************************/
     uint8_t readByte(uint8_t Device, uint8_t regAdr, uint8_t * data){
-      Wire.beginTransmission(Device);
-      Wire.write(regAdr);
-      uint8_t nackCatcher = Wire.endTransmission(STOP_CONDITION_I2C);
-      Wire.requestFrom(Device, uint8_t(1), uint8_t(1));
-      data[0] = Wire.read();
-      return nackCatcher;
+      return readBlock(Device, regAdr, 1, data);
     };
 
 /*******************************************************************************
@@ -99,12 +249,42 @@ class I2CFunctions {
   returns the nack packet
 *******************************************************************************/
     uint8_t readWord(uint8_t Device, uint8_t regAdr, uint8_t * data){
-      Wire.beginTransmission(Device);
-      Wire.write(regAdr);
-      int nackCatcher = Wire.endTransmission(STOP_CONDITION_I2C);
-      Wire.requestFrom(Device, uint8_t(2), uint8_t(1));
-      data[0] = Wire.read();
-      data[1] = Wire.read();
+      return readBlock(Device, regAdr, 2, data);
+    };
+
+/*******************************************************************************
+  readBlock : read n 8-bit uint8_t from one I2C device in one transaction
+
+  Device : the I2C device address
+  regAdr : The I2C foreign register, set the bit 7 to auto-increment the
+    register on the Lidar (0x8f reads 0x0f then 0x10)
+  n : The number of uint8_t to read (at most the Wire buffer, 32)
+  data : The data array where to put data, only the bytes received are
+    written
+
+  returns the nack packet, I2C_ERROR_SHORT_READ if fewer than n bytes were
+  received
+*******************************************************************************/
+    uint8_t readBlock(uint8_t Device, uint8_t regAdr, uint8_t n, uint8_t * data){
+      if(!guard())
+        return I2C_ERROR_TIMEOUT;
+#if ENABLE_STATISTICS
+      unsigned long start = micros();
+#endif
+      wire->beginTransmission(Device);
+      wire->write(regAdr);
+      uint8_t nackCatcher = wire->endTransmission(STOP_CONDITION_I2C);
+      if(!nackCatcher){
+        uint8_t received = wire->requestFrom(Device, n, uint8_t(1));
+        for(uint8_t i = 0; i < received and i < n; i++)
+          data[i] = wire->read();
+        if(received < n)
+          nackCatcher = I2C_ERROR_SHORT_READ;
+      }
+      nackCatcher = check(nackCatcher);
+#if ENABLE_STATISTICS
+      statistics.record(I2C_READ, start, nackCatcher);
+#endif
       return nackCatcher;
     };
 
@@ -118,8 +298,12 @@ class I2CFunctions {
 
       nDevices = 0;
       for(address = 1; address < 127; address++ ) {
-        Wire.beginTransmission(address);
-        error = Wire.endTransmission(STOP_CONDITION_I2C);
+        if(!guard()){
+          Serial.println("I2C bus stuck, SDA held low\n");
+          return;
+        }
+        wire->beginTransmission(address);
+        error = check(wire->endTransmission(STOP_CONDITION_I2C));
         if (error == 0) {
           Serial.print("I2C device found at address 0x");
           if (address<16)
@@ -164,12 +348,150 @@ class I2CFunctions {
           case 4:
             Serial.println("Other error");
             break;
+          case I2C_ERROR_TIMEOUT:
+            Serial.println("Timeout, bus cleared");
+            break;
+          case I2C_ERROR_SHORT_READ:
+            Serial.println("Short read");
+            break;
           default:
             Serial.println("No Error");
         }
       }
       return error;
     };
+
+#if ENABLE_I2C_QUEUE
+/*******************************************************************************
+  enqueueWrite : queue the write of a uint8_t to one I2C device
+
+  callback : called once the transaction is executed, can be NULL
+  context, tag : given back in the transaction to the callback
+
+  returns the queued transaction, NULL if the queue is full
+*******************************************************************************/
+    I2CTransaction * enqueueWrite(uint8_t Device, uint8_t regAdr, uint8_t data,
+        I2CCallback callback = NULL, void * context = NULL, uint8_t tag = 0){
+      I2CTransaction * transaction = enqueue(Device, regAdr, 0, callback, context, tag);
+      if(transaction)
+        transaction->data[0] = data;
+      return transaction;
+    };
+
+/*******************************************************************************
+  enqueueRead : queue the read of length (up to I2C_TRANSACTION_LENGTH) uint8_t
+  from one I2C device
+
+  The data is available in transaction->data when the callback is called
+
+  returns the queued transaction, NULL if the queue is full
+*******************************************************************************/
+    I2CTransaction * enqueueRead(uint8_t Device, uint8_t regAdr, uint8_t length,
+        I2CCallback callback = NULL, void * context = NULL, uint8_t tag = 0){
+      if(length == 0 or length > I2C_TRANSACTION_LENGTH)
+        return NULL;
+      return enqueue(Device, regAdr, length, callback, context, tag);
+    };
+
+/*******************************************************************************
+  processQueue : execute at most budget pending transactions, in order
+
+  The callback of a transaction can enqueue new transactions.
+
+  returns the number of executed transactions
+*******************************************************************************/
+    uint8_t processQueue(uint8_t budget = I2C_QUEUE_BUDGET){
+      uint8_t done = 0;
+      while(done < budget and queueTail != queueHead){
+        // The slot stays reserved until the callback returns
+        I2CTransaction * transaction = &queue[queueTail];
+        if(transaction->length == 0)
+          transaction->nack = write(transaction->device, transaction->regAdr, transaction->data[0]);
+        else
+          transaction->nack = readBlock(transaction->device, transaction->regAdr, transaction->length, transaction->data);
+        if(transaction->callback)
+          transaction->callback(transaction);
+        queueTail = (queueTail + 1) & (I2C_QUEUE_SIZE - 1);
+        done++;
+      }
+      return done;
+    };
+
+/*******************************************************************************
+  pending : returns the number of transactions waiting in the queue
+*******************************************************************************/
+    uint8_t pending(){
+      return (queueHead - queueTail) & (I2C_QUEUE_SIZE - 1);
+    };
+
+/*******************************************************************************
+  queueSpace : returns the number of transactions that can still be queued
+*******************************************************************************/
+    uint8_t queueSpace(){
+      return I2C_QUEUE_SIZE - 1 - pending();
+    };
+
+  private:
+    I2CTransaction * enqueue(uint8_t Device, uint8_t regAdr, uint8_t length,
+        I2CCallback callback, void * context, uint8_t tag){
+      uint8_t next = (queueHead + 1) & (I2C_QUEUE_SIZE - 1);
+      if(next == queueTail)
+        return NULL;
+      I2CTransaction * transaction = &queue[queueHead];
+      transaction->device = Device;
+      transaction->regAdr = regAdr;
+      transaction->length = length;
+      transaction->nack = 0;
+      transaction->tag = tag;
+      transaction->context = context;
+      transaction->callback = callback;
+      queueHead = next;
+      return transaction;
+    };
+
+    I2CTransaction queue[I2C_QUEUE_SIZE];
+    uint8_t queueHead = 0;
+    uint8_t queueTail = 0;
+#endif
+#if ENABLE_STATISTICS
+  public:
+    I2CStatistics statistics = {};
+#endif
+  private:
+/*******************************************************************************
+  check : Error of a finished transaction, a timeout clears the bus
+*******************************************************************************/
+    uint8_t check(uint8_t error){
+#ifdef WIRE_HAS_TIMEOUT
+      if(wire->getWireTimeoutFlag()){
+        wire->clearWireTimeoutFlag();
+        error = I2C_ERROR_TIMEOUT;
+      }
+#endif
+      if(error == I2C_ERROR_TIMEOUT)
+        clearBus();
+      return error;
+    };
+
+/*******************************************************************************
+  guard : Without the Wire timeout, a transaction on a stuck bus would never
+  return: SDA is idle high between two transactions, if it is low the bus is
+  cleared first
+
+  returns false if the bus is still stuck
+*******************************************************************************/
+    inline bool guard(){
+#ifndef WIRE_HAS_TIMEOUT
+      if(sdaPin != 0xff and digitalRead(sdaPin) == LOW)
+        return clearBus();
+#endif
+      return true;
+    };
+
+    TwoWire * wire;
+    bool fast = false;
+    uint8_t sdaPin = 0xff;
+    uint8_t sclPin = 0xff;
 };
 
 
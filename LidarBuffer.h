@@ -0,0 +1,95 @@
+#ifndef LIDAR_BUFFER_H
+#define LIDAR_BUFFER_H
+
+#include <Arduino.h>
+
+// One measure of a laser, as stored in the sample buffer
+struct LidarSample {
+  int16_t distance;   // Distance in cm
+  uint8_t strength;   // Signal strength
+  uint8_t status;     // Status register
+  unsigned long time; // micros() of the measure
+};
+
+/*******************************************************************************
+  LidarBuffer : single producer, single consumer ring of samples
+
+  The producer (LidarController::spinOnce) only writes head, the consumer (the
+  loop or an interrupt) only writes tail, so no interrupt has to be disabled.
+  When the ring is full, new samples are dropped and counted.
+
+  SIZE has to be a power of 2, at most 128
+*******************************************************************************/
+template <uint8_t SIZE>
+class LidarBuffer {
+  static_assert(SIZE > 0 and SIZE <= 128 and (SIZE & (SIZE - 1)) == 0,
+    "LidarBuffer SIZE has to be a power of 2, at most 128");
+  public:
+/*******************************************************************************
+  push : producer side, store a sample
+
+  returns false (and counts the drop) if the ring is full
+*******************************************************************************/
+    bool push(const LidarSample & sample){
+      uint8_t _head = head;
+      if((uint8_t)(_head - tail) >= SIZE){
+        dropped++;
+        return false;
+      }
+      samples[_head & (SIZE - 1)] = sample;
+      // The sample has to be written before it is published
+      asm volatile("" ::: "memory");
+      head = _head + 1;
+      return true;
+    };
+
+/*******************************************************************************
+  pop : consumer side, get the oldest sample
+
+  returns false if the ring is empty
+*******************************************************************************/
+    bool pop(LidarSample & sample){
+      uint8_t _tail = tail;
+      if(_tail == head)
+        return false;
+      sample = samples[_tail & (SIZE - 1)];
+      asm volatile("" ::: "memory");
+      tail = _tail + 1;
+      return true;
+    };
+
+/*******************************************************************************
+  drain : consumer side, get up to length samples at once
+
+  returns the number of samples written to out
+*******************************************************************************/
+    uint8_t drain(LidarSample * out, uint8_t length){
+      uint8_t n = 0;
+      while(n < length and pop(out[n]))
+        n++;
+      return n;
+    };
+
+/*******************************************************************************
+  available : number of samples waiting in the ring
+*******************************************************************************/
+    uint8_t available(){
+      return (uint8_t)(head - tail);
+    };
+
+/*******************************************************************************
+  clear : consumer side, drop every waiting sample
+*******************************************************************************/
+    void clear(){
+      tail = head;
+    };
+
+    volatile uint16_t dropped = 0; // Samples lost because the ring was full
+
+  private:
+    LidarSample samples[SIZE];
+    volatile uint8_t head = 0;
+    volatile uint8_t tail = 0;
+};
+
+#endif
@@ -3,6 +3,10 @@
 
 #include "I2CFunctions.h"
 #include "LidarObject.h"
+#include "LidarStatistics.h"
+#include "LidarCorrelation.h"
+#include "LidarSink.h"
+#include "LidarStorage.h"
 #include <Wire.h>
 
 // Wait between I2C transactions in µs
@@ -12,19 +16,54 @@
 #define I2C_WAIT                  50
 
 // Due to I2C problems on the LidarLite v2, it has to be enabled to avoid problems
+// Only the lasers with CAPABILITY_RESET_OFFSET (v2 or not detected) do it
 #define FORCE_RESET_OFFSET        true
 #define ENABLE_STRENGTH_MEASURE   true
 
 // For debug purpose
 #define PRINT_DEBUG_INFO          false
 #define MAX_LIDARS                8
-// Force reset on errors. It resets the lasers on MAX_NACKS error.
-// An error is a misreading (nack) or an incoherent value
-#define MAX_NACKS                 25
-#define ERROR_MAX_VALUE           1000
-#define ERROR_MIN_VALUE           4
-// Difference of measure between two measurements
-#define ERROR_MAX_DIFF_VALUE      100
+// Maximum number of I2C buses (Wire, Wire1, ...) used by one controller
+#define MAX_I2C_BUSES             3
+// Recovery: a new fault within RECOVERY_WINDOW_US << level of the last recovery
+// escalates to the next level (retry, reconfigure, soft reset, power cycle)
+#define RECOVERY_WINDOW_US        500000UL
+// Maximum shift of the power off time (LIDAR_RESET_US << n) of a flaky laser
+#define RECOVERY_MAX_BACKOFF      6
+
+// Trigger the lasers at a fixed rate from a timer tick, see schedule() and tick()
+#ifndef ENABLE_SCHEDULER
+#define ENABLE_SCHEDULER          false
+#endif
+// Period of tick() in µs (period of the timer of beginSchedulerTimer())
+#define SCHEDULER_TICK_US         1000
+
+// Configuration tuning the acquisition count online, see adapt()
+#define ADAPTIVE_CONFIGURATION    6
+// Measures between two decisions
+#define ADAPTIVE_WINDOW           16
+// Average strength under which the acquisition count is increased
+#define ADAPTIVE_STRENGTH_LOW     40
+// Average strength over which the acquisition count can be decreased
+#define ADAPTIVE_STRENGTH_HIGH    120
+// Incoherent measures in a window that increase the acquisition count
+#define ADAPTIVE_MAX_FAILURES     2
+
+// Levels of the adaptive configuration, fastest first
+struct AdaptiveLevel {
+  uint8_t sigCount;   // REG_SIG_CONT_VAL
+  uint8_t threshold;  // REG_THRESHOLD_BYPASS
+  uint16_t range;     // Longest average distance (cm) of the level
+};
+
+const AdaptiveLevel ADAPTIVE_LEVELS[] = {
+  {0x1d, 0xb0, 300},  // Short range, high speed, low sensitivity
+  {0x40, 0x00, 1000},
+  {0x80, 0x00, 2500}, // Default
+  {0xff, 0x00, 4000}, // Maximum range
+  {0xff, 0x80, 4000}  // Maximum range, high sensitivity
+};
+#define ADAPTIVE_LEVELS_COUNT     (sizeof(ADAPTIVE_LEVELS) / sizeof(AdaptiveLevel))
 
 
 // Registers are separeted between READ & WRITE registers.
@@ -49,11 +88,11 @@
  * - 0 Peak detected
  * - 1 No peak detected
  * bit 2: Signal overflow flag
- * - 0 Oveflow detected
- * - 1 No overflow
+ * - 0 No overflow
+ * - 1 Overflow detected (strong return)
  * bit 1: Reference overflow flag
- * - 0 Oveflow detected
- * - 1 No overflow
+ * - 0 No overflow
+ * - 1 Overflow detected
  * bit 0: Busy flag
  * - 0 Ready 
  * - 1 Busy
@@ -82,6 +121,8 @@
 #define REG_CORR_DATA_DUAL        0xd2
 
 #define MEASURED_VALUE_REGISTER   0x8f
+// Signal strength then distance, read in one auto-increment transaction
+#define STRENGTH_AND_VALUE_REGISTER 0x8e
 #define READ_SERIAL_REGISTERS     0x96
 
 // WRITE Registers
@@ -152,7 +193,19 @@
 // Correlation record memory bank select
 #define REG_ACQ_SETTINGS          0x5d
 // Power state control, default 0x80
+/**
+ * bit 2: Device sleep, wakes up on the next I2C transaction
+ * bit 0: Receiver circuit off, saves about 40mA
+ */
 #define REG_POWER_CONTROL         0x65
+// Hardware version, HARDWARE_VERSION_V2 on the LidarLite v2, HARDWARE_VERSION_V3
+// on the v3 (and v3HP). Any other answer keeps every workaround, define
+// HARDWARE_VERSION_V3 before the library if your v3 reports another value
+#define REG_HARDWARE_VERSION      0x41
+#define HARDWARE_VERSION_V2       0x15
+#ifndef HARDWARE_VERSION_V3
+#define HARDWARE_VERSION_V3       0x08
+#endif
 
 // Typical register data to write
 #define DATA_RESET_ALL            0x00
@@ -161,41 +214,143 @@
 #define DATA_PARTY_LINE_ON        0x00
 #define DATA_PARTY_LINE_OFF       0x08
 #define DATA_VELOCITY_MODE_DATA   0xa0
+// REG_ACQ_CONFIG bits 0-1 = 01, the mode pin is high while busy
+#define ACQ_CONFIG_STATUS_OUTPUT  0x01
+// REG_ACQ_CONFIG bit 5, use REG_MEASURE_DELAY for burst and free running mode
+#define ACQ_CONFIG_MEASURE_DELAY  0x20
+// REG_POWER_CONTROL, default (awake), receiver off and device sleep
+#define DATA_POWER_ON             0x80
+#define DATA_POWER_RECEIVER_OFF   0x81
+#define DATA_POWER_SLEEP          0x84
+// REG_COMMAND, test mode and the correlation record bank of REG_ACQ_SETTINGS
+#define DATA_TEST_MODE_ON         0x07
+#define DATA_TEST_MODE_OFF        0x00
+#define DATA_CORRELATION_BANK     0xc0
+// REG_ACQ_CONFIG bit 7, velocity mode (DATA_VELOCITY_MODE_DATA with bit 5)
+#define ACQ_CONFIG_VELOCITY       0x80
+// REG_OUTER_LOOP_COUNT, indefinite repetition after initial command
+#define DATA_FREE_RUNNING         0xff
+// Time after a trigger before trusting the mode pin (busy not yet raised)
+#define STATUS_PIN_SETTLE_US      50
+// Low pulse on the trigger pins of the synchronized lasers, see synchronize()
+#define SYNC_TRIGGER_PULSE_US     20
+
+/*******************************************************************************
+  LidarMask: smallest unsigned type with one bit per laser (at most 32)
+*******************************************************************************/
+template <uint8_t N, bool = (N <= 8), bool = (N <= 16)>
+struct LidarMask { typedef uint32_t type; };
+template <uint8_t N>
+struct LidarMask<N, false, true> { typedef uint16_t type; };
+template <uint8_t N, bool Medium>
+struct LidarMask<N, true, Medium> { typedef uint8_t type; };
 
-class LidarController {
+/*******************************************************************************
+  LidarControllerN: controller of at most N lasers
+
+  The state machine keeps the state and the address of each laser in dense
+  arrays, the laser objects are only used for their data and pins. Unused
+  slots cost nothing, use LidarControllerN<12> for bigger setups. 
+  LidarController is the controller of MAX_LIDARS lasers.
+
+  The results go to Sink (LidarSink.h), by default the callbacks of the
+  Lidar objects.
+*******************************************************************************/
+template <uint8_t N, class Sink = LidarCallbackSink>
+class LidarControllerN {
+  static_assert(N <= 32, "LidarControllerN handles at most 32 lasers");
+  typedef typename LidarMask<N>::type Mask;
   public:
     /*******************************************************************************
       begin:
-      Start the I2C line with the correct frequency
+      Start the I2C lines with the correct frequency (the buses of lidars added
+      later are started when they are added)
     *******************************************************************************/
     void begin(bool fasti2c = false) {
-      Wire.begin();
-      if (fasti2c) {
-#if ARDUINO >= 157
-        Wire.setClock(400000UL); // Set I2C frequency to 400kHz, for the Due
-#else
-        TWBR = ((F_CPU / 400000UL) - 16) / 2; // Set I2C frequency to 400kHz
-#endif
+      fastI2C = fasti2c;
+      begun = true;
+      I2C.begin(fasti2c);
+      for (uint8_t b = 0; b < busCount; b++) {
+        if (busList[b] != &I2C)
+          busList[b]->begin(fasti2c);
       }
+#if ENABLE_STORAGE
+      storageValid = LidarStorage::begin();
+#endif
     }
 
+#if ENABLE_STORAGE
+    /*******************************************************************************
+      save: Write the serial, address and tuning of the lasers in EEPROM, the
+      next begin() restores them (see LidarStorage). Call it once the lasers
+      are acquiring, their serial is learnt on their first reset.
+
+        returns the number of lasers saved
+    *******************************************************************************/
+    uint8_t save() {
+      uint8_t saved = LidarStorage::save(lidars, N);
+      storageValid = true;
+      return saved;
+    };
+#endif
+
     /*******************************************************************************
       add:
       Add a new Lidar and use resetLidar: It assure the lidar is NOT on the 0x62 line
+
+      Warm restart: after begin(), a Lidar already answering at its address
+      (the Arduino was reset, not the Lidar) is configured and started without
+      power cycle nor addressing
+
+      Returns false if the id is too big or if the lidar is on a new bus while
+      MAX_I2C_BUSES buses are already used
     *******************************************************************************/
     bool add(LidarObject* _Lidar, uint8_t _id) {
-      if (_id >= MAX_LIDARS)
+      if (_id >= N)
         return false;
+      uint8_t busId = 0;
+      while (busId < busCount and busList[busId] != _Lidar->bus)
+        busId++;
+      if (busId == busCount) {
+        if (busCount >= MAX_I2C_BUSES)
+          return false;
+        busList[busCount++] = _Lidar->bus;
+        if (begun)
+          _Lidar->bus->begin(fastI2C);
+      }
+#if ENABLE_STORAGE
+      // Stored serial and tuning, the first reset addresses it by serial
+      if (storageValid)
+        LidarStorage::restore(*_Lidar);
+#endif
       lidars[_id] = _Lidar;
-      resetLidar(_id);
+      addresses[_id] = _Lidar->address;
+      busIds[_id] = busId;
+      states[_id] = NEED_RESET;
+      for (uint8_t f = 0; f < 2; f++) {
+        frameDistance[f][_id] = _Lidar->distance;
+        frameStrength[f][_id] = _Lidar->strength;
+      }
+#if ENABLE_STATISTICS
+      lidarStatistics[_id].reset(micros());
+#endif
       count++;
+      // Warm restart, the Lidar kept its power and its address
+      if (begun and addresses[_id] != 0x62 and bus(_id).isOnline(addresses[_id])) {
+        if (!_Lidar->versionSet)
+          detectVersion(_id);
+        startLidar(_id);
+        return true;
+      }
+      resetLidar(_id);
       return true;
     }
 
     /*******************************************************************************
       configure: Configure the default acquisition mode
 
-      configuration: The configuration of the Lidar
+      configuration: The configuration of the Lidar, ADAPTIVE_CONFIGURATION to
+        tune the acquisition count online (see adapt())
       
       Lidar: Address of the Lidar (0x62 by default)
     *******************************************************************************/
@@ -203,43 +358,57 @@ class LidarController {
       // REG_SIG_CONT_VAL = Maximum acquisition count, default 0x80
       // REG_ACQ_CONFIG = Acquisition mode control, default 0x08
       // REG_THRESHOLD_BYPASS = Peak detection threshold bypass, default 0x00
+      uint8_t sigCount = 0x80; // Default
+      uint8_t acqConfig = 0x08; // Default
+      uint8_t threshold = 0x00; // Default
       switch (configuration){
         case 0: // Default mode, balanced performance
-          I2C.write(lidars[Lidar]->address, REG_SIG_CONT_VAL, 0x80); // Default
-          I2C.write(lidars[Lidar]->address, REG_ACQ_CONFIG, 0x08); // Default
-          I2C.write(lidars[Lidar]->address, REG_THRESHOLD_BYPASS, 0x00); // Default
         break;
     
         case 1: // Short range, high speed
-          I2C.write(lidars[Lidar]->address, REG_SIG_CONT_VAL, 0x1d);
-          I2C.write(lidars[Lidar]->address, REG_ACQ_CONFIG, 0x08); // Default
-          I2C.write(lidars[Lidar]->address, REG_THRESHOLD_BYPASS, 0x00); // Default
+          sigCount = 0x1d;
         break;
     
         case 2: // Default range, higher speed short range
-          I2C.write(lidars[Lidar]->address, REG_SIG_CONT_VAL, 0x80); // Default
-          I2C.write(lidars[Lidar]->address, REG_ACQ_CONFIG, 0x00);
-          I2C.write(lidars[Lidar]->address, REG_THRESHOLD_BYPASS, 0x00); // Default
+          acqConfig = 0x00;
         break;
     
         case 3: // Maximum range
-          I2C.write(lidars[Lidar]->address, REG_SIG_CONT_VAL, 0xff);
-          I2C.write(lidars[Lidar]->address, REG_ACQ_CONFIG, 0x08); // Default
-          I2C.write(lidars[Lidar]->address, REG_THRESHOLD_BYPASS, 0x00); // Default
+          sigCount = 0xff;
         break;
     
         case 4: // High sensitivity detection, high erroneous measurements
-          I2C.write(lidars[Lidar]->address, REG_SIG_CONT_VAL, 0x80); // Default
-          I2C.write(lidars[Lidar]->address, REG_ACQ_CONFIG, 0x08); // Default
-          I2C.write(lidars[Lidar]->address, REG_THRESHOLD_BYPASS, 0x80);
+          threshold = 0x80;
         break;
     
         case 5: // Low sensitivity detection, low erroneous measurements
-          I2C.write(lidars[Lidar]->address, REG_SIG_CONT_VAL, 0x80); // Default
-          I2C.write(lidars[Lidar]->address, REG_ACQ_CONFIG, 0x08); // Default
-          I2C.write(lidars[Lidar]->address, REG_THRESHOLD_BYPASS, 0xb0);
+          threshold = 0xb0;
+        break;
+
+        case ADAPTIVE_CONFIGURATION: // Tuned online by adapt(), starts from the last level
+          sigCount = ADAPTIVE_LEVELS[lidars[Lidar]->adaptiveLevel].sigCount;
+          threshold = ADAPTIVE_LEVELS[lidars[Lidar]->adaptiveLevel].threshold;
         break;
       }
+      // Status output mode, the mode pin is high while busy
+      if (lidars[Lidar]->statusPin)
+        acqConfig |= ACQ_CONFIG_STATUS_OUTPUT;
+      // Free running mode, the next async() starts an indefinite repetition
+      // The velocity is the distance change between two of those measures
+      if (lidars[Lidar]->isFreeRunning()) {
+        acqConfig |= ACQ_CONFIG_MEASURE_DELAY;
+        if (lidars[Lidar]->mode & VELOCITY) {
+          acqConfig |= ACQ_CONFIG_VELOCITY;
+          lidars[Lidar]->velocityTime = micros();
+        }
+        bus(Lidar).write(addresses[Lidar], REG_MEASURE_DELAY, lidars[Lidar]->measureDelay);
+        bus(Lidar).write(addresses[Lidar], REG_OUTER_LOOP_COUNT, DATA_FREE_RUNNING);
+      }
+      bus(Lidar).write(addresses[Lidar], REG_SIG_CONT_VAL, sigCount);
+      bus(Lidar).write(addresses[Lidar], REG_ACQ_CONFIG, acqConfig);
+      bus(Lidar).write(addresses[Lidar], REG_THRESHOLD_BYPASS, threshold);
+      if (lidars[Lidar]->offset)
+        setOffset(Lidar, lidars[Lidar]->offset);
     };
 
     /*******************************************************************************
@@ -254,39 +423,82 @@ class LidarController {
             6 if the Lidar do not respond
     *******************************************************************************/
     uint8_t changeAddress(uint8_t Lidar) {
-      uint8_t _lidar_new = lidars[Lidar]->address;
-      uint8_t nack = 0;
+      uint8_t _lidar_new = addresses[Lidar];
       // Return 6 = The device do not respond
-      if (!I2C.isOnline(0x62)){
+      if (!bus(Lidar).isOnline(0x62)){
         shouldIncrementNack(Lidar, 1); // If we set anything else than 0, it increments
         return 6;
       }
       // Return 5 = We already got an I2C device at this place
-      if (I2C.isOnline(_lidar_new)){
+      if (bus(Lidar).isOnline(_lidar_new)){
         shouldIncrementNack(Lidar, 1);
         return 5;
       }
       /* Serial number part */
       unsigned char serialNumber[2];
-      shouldIncrementNack(Lidar, I2C.readWord(0x62, 0x96, serialNumber));
+      if (!shouldIncrementNack(Lidar, bus(Lidar).readWord(0x62, 0x96, serialNumber)))
+        lidars[Lidar]->setSerial((serialNumber[0] << 8) | serialNumber[1]);
       // Return 1 = Error sending the Serial (uint8_t 1)
-      if (shouldIncrementNack(Lidar, I2C.write(0x62, 0x18, serialNumber[0])))
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(0x62, 0x18, serialNumber[0])))
         return 1;
       // Return 2 = Error sending the Serial (uint8_t 2)
-      if (shouldIncrementNack(Lidar, I2C.write(0x62, 0x19, serialNumber[1])))
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(0x62, 0x19, serialNumber[1])))
         return 2;
 
       // Return 3 = Error sending the Lidar address
-      if (shouldIncrementNack(Lidar, I2C.write(0x62, 0x1a, _lidar_new)))
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(0x62, 0x1a, _lidar_new)))
         return 3;
 
       // Return 4 = Error disabling the Lidar Main address (0x62)
-      if (shouldIncrementNack(Lidar, I2C.write(0x62, 0x1e, 0x08)))
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(0x62, 0x1e, 0x08)))
         return 4;
 
       return 0;
     };
 
+    /*******************************************************************************
+      changeAddressBySerial: Change the address of one Lidar with its known serial
+
+      Only the Lidar with this serial accepts the new address, the others 
+      listening on 0x62 ignore it. Lidars with a known serial can then be 
+      powered and addressed at the same time.
+
+      returns 0 if success
+            1 if error writing the serial number (uint8_t 1)
+            2 if error writing the serial number (uint8_t 2)
+            3 if error sending or enabling the Lidar address
+            4 if error disabling the main address
+            6 if the Lidar do not respond at its new address (wrong serial), the
+              serial is forgotten to use changeAddress on the next reset
+    *******************************************************************************/
+    uint8_t changeAddressBySerial(uint8_t Lidar) {
+      uint8_t _lidar_new = addresses[Lidar];
+      uint16_t serial = lidars[Lidar]->serial;
+      // Return 1 = Error sending the Serial (uint8_t 1)
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(0x62, REG_I2C_ID_HIGH, serial >> 8)))
+        return 1;
+      // Return 2 = Error sending the Serial (uint8_t 2)
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(0x62, REG_I2C_ID_LOW, serial & 0xff)))
+        return 2;
+      // Return 3 = Error sending the Lidar address
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(0x62, REG_I2C_SEC_ADDR, _lidar_new)))
+        return 3;
+      // Return 3 = Error enabling the new address, 0x62 is kept for now
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(0x62, REG_I2C_CONFIG, 0x00)))
+        return 3;
+      // Return 6 = No Lidar took the address, the serial is not (anymore) valid
+      if (!bus(Lidar).isOnline(_lidar_new)) {
+        shouldIncrementNack(Lidar, 1);
+        lidars[Lidar]->hasSerial = false;
+        return 6;
+      }
+      // Return 4 = Error disabling the main address (0x62), through the new 
+      // address to only disable this Lidar
+      if (shouldIncrementNack(Lidar, bus(Lidar).write(_lidar_new, REG_I2C_CONFIG, DATA_PARTY_LINE_OFF)))
+        return 4;
+      return 0;
+    };
+
     /*******************************************************************************
       status: check the status of the Lidar
 
@@ -295,11 +507,27 @@ class LidarController {
     uint8_t status(uint8_t Lidar = 0) {
       uint8_t data[1] = {171}; // Initializing with a non 0 NOR 1 data to ensure we got
       // no interference
-      uint8_t nack = I2C.readByte(lidars[Lidar]->address, REG_STATUS, data);
+      uint8_t nack = bus(Lidar).readByte(addresses[Lidar], REG_STATUS, data);
       shouldIncrementNack(Lidar, nack);
+      lidars[Lidar]->status = data[0];
       return data[0];
     };
 
+    /*******************************************************************************
+      isReady: check if the acquisition of the Lidar is done
+
+      Reads the mode pin if the Lidar uses the status output mode (no I2C
+      transaction), the busy flag of the status register otherwise
+    *******************************************************************************/
+    bool isReady(uint8_t Lidar = 0) {
+      if (lidars[Lidar]->statusPin) {
+        if (micros() - lidars[Lidar]->triggerTime < STATUS_PIN_SETTLE_US)
+          return false;
+        return !lidars[Lidar]->isBusyPin();
+      }
+      return bitRead(status(Lidar), 0) == 0;
+    };
+
     /*******************************************************************************
       async: start an acquisition
                   - with preamp enabled
@@ -309,9 +537,26 @@ class LidarController {
     *******************************************************************************/
     uint8_t async(uint8_t Lidar = 0, bool biasCorrection = true) {
       uint8_t nack = 0;
-      if(biasCorrection) nack = I2C.write(lidars[Lidar]->address, REG_ACQ_COMMAND, DATA_MEASURE_WITH_BIAS);
-      else nack = I2C.write(lidars[Lidar]->address, REG_ACQ_COMMAND, DATA_MEASURE_WITHOUT_BIAS);
+      lidars[Lidar]->triggerTime = micros();
+      if(biasCorrection) nack = bus(Lidar).write(addresses[Lidar], REG_ACQ_COMMAND, DATA_MEASURE_WITH_BIAS);
+      else nack = bus(Lidar).write(addresses[Lidar], REG_ACQ_COMMAND, DATA_MEASURE_WITHOUT_BIAS);
       shouldIncrementNack(Lidar, nack);
+      return nack;
+    };
+
+    /*******************************************************************************
+      nextBias: returns true if the next acquisition of the Lidar has to be bias
+        corrected, once every biasPeriod acquisitions (LidarObject::setBiasPeriod)
+        unless spinOnce(false) disables it
+    *******************************************************************************/
+    bool nextBias(uint8_t Lidar = 0) {
+      LidarObject * lidar = lidars[Lidar];
+      if (!biasCorrection or lidar->biasPeriod == 0)
+        return false;
+      if (++lidar->biasCount < lidar->biasPeriod)
+        return false;
+      lidar->biasCount = 0;
+      return true;
     };
 
     /*******************************************************************************
@@ -320,16 +565,42 @@ class LidarController {
     *******************************************************************************/
     uint8_t distance(uint8_t Lidar, int16_t * data) {
       uint8_t distanceArray[2];
-      uint8_t nackCatcher = I2C.readWord(lidars[Lidar]->address, MEASURED_VALUE_REGISTER, distanceArray);
+      uint8_t nackCatcher = bus(Lidar).readWord(addresses[Lidar], MEASURED_VALUE_REGISTER, distanceArray);
       shouldIncrementNack(Lidar, nackCatcher);
       int16_t distance = (distanceArray[0] << 8) + distanceArray[1];
       *data = distance;
       return nackCatcher;
     };
 
+    /*******************************************************************************
+      readMeasurement: Read the distance (and the signal strength if
+      ENABLE_STRENGTH_MEASURE) in a single auto-increment transaction
+
+      The signal strength (0x0e) is right before the distance (0x0f, 0x10).
+      The strength is stored in the Lidar object, the status is the one of the
+      last status() call. Returns the nack error (0 if no error)
+    *******************************************************************************/
+    uint8_t readMeasurement(uint8_t Lidar, int16_t * data) {
+#if ENABLE_STRENGTH_MEASURE
+      uint8_t measureArray[3];
+      uint8_t nackCatcher = bus(Lidar).readBlock(addresses[Lidar], STRENGTH_AND_VALUE_REGISTER, 3, measureArray);
+      if (!shouldIncrementNack(Lidar, nackCatcher)) {
+        lidars[Lidar]->strength = measureArray[0];
+        *data = (measureArray[1] << 8) + measureArray[2];
+      }
+#else
+      uint8_t measureArray[2];
+      uint8_t nackCatcher = bus(Lidar).readBlock(addresses[Lidar], MEASURED_VALUE_REGISTER, 2, measureArray);
+      if (!shouldIncrementNack(Lidar, nackCatcher))
+        *data = (measureArray[0] << 8) + measureArray[1];
+#endif
+      return nackCatcher;
+    };
+
     /*******************************************************************************
       Velocity scaling:
-        - Scale the velocity measures
+        - Scale the velocity measures, sets the period of the velocity (and free
+        running) measures. It is kept for the next configure().
 
         CAUTION, different than the Scale function from LidarLite (not 1,2,3,4 but 
         the actual period measurment, Note the x2 between 100 and 0xC8 (200))
@@ -341,28 +612,29 @@ class LidarController {
         40           | 0.25 m/s         | 0x50             
         20           | 0.50 m/s         | 0x28             
         10           | 1.00 m/s         | 0x14             
+
+        0 is raised to 1, velocityScale() and measurePeriod() divide and wait by it
     *******************************************************************************/
     void scale(uint8_t Lidar, uint8_t velocityScaling){
-        I2C.write(lidars[Lidar]->address, REG_MEASURE_DELAY, velocityScaling);
+        if (velocityScaling == 0)
+          velocityScaling = 1;
+        lidars[Lidar]->measureDelay = velocityScaling;
+        bus(Lidar).write(addresses[Lidar], REG_MEASURE_DELAY, velocityScaling);
     };
 
     /*******************************************************************************
-      Velocity  NOT WORKING (guess, since there is no wait):
-        - Read the velocity
+      velocity:
+        - Read the velocity register (signed, cm per measure period), the Lidar has
+        to be configured in velocity mode (mode VELOCITY or DISTANCE_AND_VELOCITY)
 
-        This has to be worked on, this is the original implementation without the 
-          blocking architecture
+        returns the nack error (0 if no error)
     *******************************************************************************/
-    int velocity(uint8_t Lidar, int * data) {
-      // Set in velocity mode
-      I2C.write(lidars[Lidar]->address, REG_ACQ_CONFIG, DATA_VELOCITY_MODE_DATA);
-      //  Write 0x04 to register 0x00 to start getting distance readings
-      I2C.write(lidars[Lidar]->address, REG_ACQ_COMMAND, DATA_MEASURE_WITH_BIAS);
-
+    uint8_t velocity(uint8_t Lidar, int8_t * data) {
       uint8_t velocityArray[1];
-      uint8_t nack = I2C.readByte(lidars[Lidar]->address, REG_VELOCITY, velocityArray);
-
-      return((int)((char)velocityArray[0]));
+      uint8_t nack = bus(Lidar).readByte(addresses[Lidar], REG_VELOCITY, velocityArray);
+      if (!shouldIncrementNack(Lidar, nack))
+        *data = (int8_t) velocityArray[0];
+      return nack;
     };
 
     /*******************************************************************************
@@ -370,7 +642,49 @@ class LidarController {
         - Read the signal strength of the last reading
     *******************************************************************************/
     uint8_t signalStrength(uint8_t Lidar, uint8_t * signalStrengthArray) {
-      uint8_t nack = I2C.readByte(lidars[Lidar]->address, REG_SIGNAL_STRENGTH, signalStrengthArray);
+      uint8_t nack = bus(Lidar).readByte(addresses[Lidar], REG_SIGNAL_STRENGTH, signalStrengthArray);
+      shouldIncrementNack(Lidar, nack);
+      return nack;
+    };
+
+    /*******************************************************************************
+      correlationRecord:
+        - Read the correlation record of the last acquisition (test mode) and
+        find its peaks, the first and second returns, on the way
+
+        peaks: the peak finder, reset before the first point
+        length: number of points to read, up to CORRELATION_RECORD_LENGTH
+        record: optional buffer of length points, NULL to only find the peaks
+
+        Each point is a 2 bytes read of REG_CORR_DATA_DUAL, the laser moves to
+        the next point by itself. The sign is the bit 0 of the high byte.
+        Blocking (about 40ms for 256 points at 400kHz). Any acquisition
+        overwrites the record, and spinOnce() triggers the next one right
+        after a read: call it between two spinOnce() while a scheduled lidar
+        waits for its tick (WAITING_TRIGGER, see schedule()).
+
+        returns the first nack error (0 if no error), the test mode is always
+        disabled at the end
+    *******************************************************************************/
+    uint8_t correlationRecord(uint8_t Lidar, LidarPeakFinder & peaks, uint16_t length = CORRELATION_RECORD_LENGTH, int16_t * record = NULL) {
+      uint8_t address = addresses[Lidar];
+      peaks.reset();
+      uint8_t nack = bus(Lidar).write(address, REG_ACQ_SETTINGS, DATA_CORRELATION_BANK);
+      if (!nack)
+        nack = bus(Lidar).write(address, REG_COMMAND, DATA_TEST_MODE_ON);
+      for (uint16_t i = 0; i < length and !nack; i++) {
+        uint8_t point[2];
+        nack = bus(Lidar).readWord(address, REG_CORR_DATA_DUAL, point);
+        if (nack)
+          break;
+        int16_t value = point[1] & 0x01 ? (int16_t) (0xff00 | point[0]) : point[0];
+        if (record)
+          record[i] = value;
+        peaks.add(value);
+      }
+      uint8_t restore = bus(Lidar).write(address, REG_COMMAND, DATA_TEST_MODE_OFF);
+      if (!nack)
+        nack = restore;
       shouldIncrementNack(Lidar, nack);
       return nack;
     };
@@ -379,21 +693,41 @@ class LidarController {
       setState: Change the status of the Lidar Object
     *******************************************************************************/
     void setState(uint8_t Lidar = 0, LIDAR_STATE _lidar_state = NEED_RESET) {
+#if ENABLE_STATISTICS
+      if (states[Lidar] != _lidar_state)
+        lidarStatistics[Lidar].changeState((LIDAR_STATE) states[Lidar], micros());
+#endif
+      Mask bit = (Mask) 1 << Lidar;
+      Mask sleeping = timedMask() & ~bit;
+      for (uint8_t s = 0; s < LIDAR_STATE_COUNT; s++)
+        stateMask[s] &= ~bit;
+      stateMask[lidarStateIndex(_lidar_state)] |= bit;
+      states[Lidar] = _lidar_state;
+      frameState[1 - front][Lidar] = _lidar_state;
       lidars[Lidar]->lidar_state = _lidar_state;
+      // Timed states sleep until their deadline (see LidarObject::checkTimer)
+      if (_lidar_state == SHUTING_DOWN or _lidar_state == RESET_PENDING) {
+        deadline[Lidar] = lidars[Lidar]->timeReset + (_lidar_state == SHUTING_DOWN ?
+          lidars[Lidar]->holdOff : LIDAR_RESET_US + 1);
+        if (!sleeping or (long) (deadline[Lidar] - nextWake) < 0)
+          nextWake = deadline[Lidar];
+      } else if (_lidar_state == NEED_RESET) {
+        resetEvent = true;
+      }
     };
 
     /*******************************************************************************
       getState: Get the status of the Lidar Object
     *******************************************************************************/
     LIDAR_STATE getState(uint8_t Lidar = 0) {
-      return lidars[Lidar]->lidar_state;
+      return (LIDAR_STATE) states[Lidar];
     };
 
     /*******************************************************************************
       setOffset: Set an offset to the Lidar
     *******************************************************************************/
     void setOffset(uint8_t Lidar, uint8_t data) {
-        I2C.write(lidars[Lidar]->address, REG_OFFSET_REGISTER, data);
+        bus(Lidar).write(addresses[Lidar], REG_OFFSET_REGISTER, data);
     };
 
     /*******************************************************************************
@@ -417,23 +751,117 @@ class LidarController {
         * set the Power Enable pin to 0
         * set the Need Reset state to be reinitialized 20ms later
     *******************************************************************************/
-    void resetLidar(uint8_t Lidar = 0) {
+    void resetLidar(uint8_t Lidar = 0, unsigned long holdOff = 0) {
+      releaseReset(Lidar);
       lidars[Lidar]->off();
+      // A PWM Lidar boots idle, it is triggered again once configured
+      if (lidars[Lidar]->isPWM())
+        lidars[Lidar]->disable();
+      lidars[Lidar]->holdOff = holdOff;
       lidars[Lidar]->timerUpdate();
       setState(Lidar, SHUTING_DOWN);
     };
 
+    /*******************************************************************************
+      releaseReset:
+        * release the reset latch (or the parallel reset) if the lidar is resetted 
+        while in RESET_PENDING
+    *******************************************************************************/
+    void releaseReset(uint8_t Lidar = 0) {
+      if (getState(Lidar) != RESET_PENDING)
+        return;
+      if (parallel[Lidar])
+        parallelResets[busIds[Lidar]]--;
+      else
+        resetOngoing[busIds[Lidar]] = false;
+      resetEvent = true;
+    };
+
+    /*******************************************************************************
+      recover: Recover a faulty lidar (too much nacks or no measure) with the
+      cheapest action first, escalating if the fault comes back soon:
+        * RECOVERY_RETRY: start a new acquisition
+        * RECOVERY_RECONFIGURE: write the configuration again, then retry
+        * RECOVERY_SOFT_RESET: reset the registers (DATA_RESET_ALL) and address it
+          by serial without power cycle, only if the serial is known
+        * RECOVERY_POWER_CYCLE: power cycle, the power off time doubles on each
+          consecutive power cycle so a flaky lidar does not hold the reset latch
+    *******************************************************************************/
+    void recover(uint8_t Lidar = 0) {
+      LidarObject * lidar = lidars[Lidar];
+      unsigned long now = micros();
+      if (lidar->recoveryTime != 0 and now - lidar->recoveryTime < (RECOVERY_WINDOW_US << lidar->recoveryLevel)) {
+        if (lidar->recoveryLevel < RECOVERY_POWER_CYCLE)
+          lidar->recoveryLevel++;
+      } else {
+        lidar->recoveryLevel = RECOVERY_RETRY;
+        lidar->powerCycles = 0;
+      }
+      lidar->recoveryTime = now;
+      lidar->resetNacksCount();
+#if ENABLE_STATISTICS
+      lidarStatistics[Lidar].recoveries++;
+#endif
+
+      switch (lidar->recoveryLevel) {
+        case RECOVERY_RECONFIGURE:
+          configure(Lidar, lidar->configuration);
+          // fall through
+        case RECOVERY_RETRY:
+          if (lidar->isPWM())
+            lidar->disable();
+          startAcquisition(Lidar, nextBias(Lidar));
+          lidar->lastMeasureTime = now;
+          break;
+        case RECOVERY_SOFT_RESET:
+          if (lidar->hasSerial and canReset(Lidar)) {
+            bus(Lidar).write(addresses[Lidar], REG_ACQ_COMMAND, DATA_RESET_ALL);
+            parallel[Lidar] = true;
+            parallelResets[busIds[Lidar]]++;
+            lidar->timerUpdate();
+            setState(Lidar, RESET_PENDING);
+            break;
+          }
+          lidar->recoveryLevel = RECOVERY_POWER_CYCLE;
+          // fall through
+        default:
+          resetLidar(Lidar, LIDAR_RESET_US << lidar->powerCycles);
+          if (lidar->powerCycles < RECOVERY_MAX_BACKOFF)
+            lidar->powerCycles++;
+          break;
+      }
+    };
+
     /*******************************************************************************
       preReset:
-        * set the reset latch (resetOngoing) to true to prevent starting 2 lidars simultaneously
+        * set the reset latch (resetOngoing) of the bus to true to prevent starting 2 lidars
+        simultaneously on the same bus
+        * lidars with a known serial do not take the latch, they are addressed by
+        serial and counted in parallelResets instead
         * set the lidar on & start the 16 µS timer
     *******************************************************************************/
     void preReset(uint8_t Lidar = 0) {
-      resetOngoing = true;
+      parallel[Lidar] = lidars[Lidar]->hasSerial;
+      if (parallel[Lidar])
+        parallelResets[busIds[Lidar]]++;
+      else
+        resetOngoing[busIds[Lidar]] = true;
       lidars[Lidar]->on();
       lidars[Lidar]->timerUpdate();
     };
 
+    /*******************************************************************************
+      canReset:
+        * returns true if the lidar can be powered on now. Lidars addressed by 
+        serial wait for the reset latch, the others also wait for the lidars 
+        addressed by serial since they both listen on 0x62 until addressed
+    *******************************************************************************/
+    bool canReset(uint8_t Lidar = 0) {
+      if (resetOngoing[busIds[Lidar]])
+        return false;
+      return lidars[Lidar]->hasSerial or parallelResets[busIds[Lidar]] == 0;
+    };
+
 
     /*******************************************************************************
       getCount:
@@ -443,37 +871,96 @@ class LidarController {
       return count;
     };
 
+    /*******************************************************************************
+      bus:
+        * returns the I2C bus of the laser
+    *******************************************************************************/
+    inline I2CFunctions & bus(uint8_t Lidar){
+      return *busList[busIds[Lidar]];
+    };
+
     /*******************************************************************************
       postReset:
-        * change the lidar address
+        * change the lidar address (by serial if known)
         * stop the reset ongoing
+        * detect the hardware version, unless set by LidarObject::setVersion
     *******************************************************************************/
     void postReset(uint8_t Lidar = 0) {
-      changeAddress(Lidar);
-      resetOngoing = false;
+      if (parallel[Lidar]) {
+        changeAddressBySerial(Lidar);
+        parallelResets[busIds[Lidar]]--;
+      } else {
+        changeAddress(Lidar);
+        resetOngoing[busIds[Lidar]] = false;
+      }
+      resetEvent = true;
+      if (!lidars[Lidar]->versionSet)
+        detectVersion(Lidar);
     };
 
+    /*******************************************************************************
+      startLidar:
+        * configure the lidar (addressed) and start its first acquisition, after
+        a reset or a warm restart
+    *******************************************************************************/
+    void startLidar(uint8_t Lidar = 0) {
+#if ENABLE_FILTER
+      lidars[Lidar]->filter.reset();
+#endif
+      configure(Lidar, lidars[Lidar]->configuration);
+      // The first measure after a reset is always bias corrected
+      lidars[Lidar]->biasCount = 0;
+      startAcquisition(Lidar);
+      lidars[Lidar]->lastMeasureTime = micros();
+      setState(Lidar, ACQUISITION_IN_PROGRESS);
+    };
 
     /*******************************************************************************
-      shouldIncrementNack: increments the nacksCount if nack happens
+      detectVersion: Read the hardware version of the Lidar and store it with its 
+      capabilities (workarounds) in the Lidar object
+
+        The LidarLite v2 reports HARDWARE_VERSION_V2, the v3 HARDWARE_VERSION_V3
+        (the v3HP is not told apart, it has the same capabilities). On a nack or
+        any other answer (a v1, another revision, a glitched read) the version
+        stays unknown and every workaround is kept.
+
+      returns the detected version
     *******************************************************************************/
-    uint8_t shouldIncrementNack(uint8_t Lidar = 0, uint8_t nack = 0){
-      if(nack){
-        lidars[Lidar]->nacksCount += 1;
-      } else {
-        // reduce number of resets... but is not valid as it will never reset.
-        //lidars[Lidar]->nacksCount = max(lidars[Lidar]->nacksCount - 1, 0); ;
+    LIDAR_VERSION detectVersion(uint8_t Lidar = 0) {
+      uint8_t hardware = 0;
+      LIDAR_VERSION version = VERSION_UNKNOWN;
+      if (!shouldIncrementNack(Lidar, bus(Lidar).readByte(addresses[Lidar], REG_HARDWARE_VERSION, &hardware))) {
+        if (hardware == HARDWARE_VERSION_V2)
+          version = LIDAR_LITE_V2;
+        else if (hardware == HARDWARE_VERSION_V3)
+          version = LIDAR_LITE_V3;
       }
+      lidars[Lidar]->version = version;
+      lidars[Lidar]->capabilities = versionCapabilities(version);
+      return version;
+    };
+
+
+    /*******************************************************************************
+      shouldIncrementNack: adds LIDAR_ERROR_WEIGHT to the error score (nacksCount)
+      if nack happens. The score decays by one per good measure (processMeasure,
+      processVelocity in VELOCITY mode), not per transaction: a lidar polled
+      many times per measure would never reach maxErrors
+    *******************************************************************************/
+    uint8_t shouldIncrementNack(uint8_t Lidar = 0, uint8_t nack = 0){
+      if(nack and lidars[Lidar]->nacksCount < 0xffff - LIDAR_ERROR_WEIGHT)
+        lidars[Lidar]->nacksCount += LIDAR_ERROR_WEIGHT;
       return nack;
     };
 
     /*******************************************************************************
       checkNacks: Returns if the laser needs or not a reset
-        if have to be resetted, reset the counter and return true. The setState
-        instruction have to be in the spinOnce function
+        if have to be resetted (error score over maxErrors errors), reset the
+        counter and return true. The setState instruction have to be in the
+        spinOnce function
     *******************************************************************************/
     bool checkNacks(uint8_t Lidar = 0){
-      if(lidars[Lidar]->nacksCount > MAX_NACKS){
+      if(lidars[Lidar]->nacksCount > (uint16_t) lidars[Lidar]->maxErrors * LIDAR_ERROR_WEIGHT){
         lidars[Lidar]->resetNacksCount();
         return true;
       }
@@ -488,59 +975,148 @@ class LidarController {
             Get the data and store it in distances
             -> Go to ACQUISITION_READY
           * ACQUISITION_DONE => NOT_USED
+          * WAITING_TRIGGER => Scheduled lasers wait for their tick to start the
+          next acquisition, synchronized lasers wait for the others of the
+          group => ACQUISITION_IN_PROGRESS
           * NEED_RESET => The Lidar is OFF and waits to be started => RESET_PENDING
           * RESET_PENDING => The Lidar is ON, after being OFF and waits 16 µS to be
-          ready. No other laser can be on at this time => ACQUISITION_READY
+          ready. No other laser can be on at this time, except lasers with a
+          known serial which are all resetted together => ACQUISITION_READY
+
+        With ENABLE_I2C_QUEUE, the acquisition transactions are queued and at
+        most I2C_QUEUE_BUDGET of them are executed per call.
+
+        Only the lidars with work are visited: the acquiring ones, the timed
+        ones (SHUTING_DOWN, RESET_PENDING) once their deadline is reached, the
+        NEED_RESET ones when a reset latch is released and the WAITING_TRIGGER
+        ones after a tick. A pass over idle lidars costs a few mask tests.
+
+        biasCorrection: false disables the bias correction of every lidar,
+        true follows the bias period of each lidar (see nextBias())
     *******************************************************************************/
     void spinOnce(bool biasCorrection = true) {
+#if ENABLE_STATISTICS
+      unsigned long spinStart = micros();
+#endif
+      this->biasCorrection = biasCorrection;
+      Mask visit = stateMask[lidarStateIndex(ACQUISITION_IN_PROGRESS)];
+      if (resetEvent) {
+        resetEvent = false;
+        visit |= stateMask[lidarStateIndex(NEED_RESET)];
+      }
+#if ENABLE_SCHEDULER
+      if (dueEvent) {
+        dueEvent = false;
+        visit |= stateMask[lidarStateIndex(WAITING_TRIGGER)];
+      }
+#else
+      visit |= stateMask[lidarStateIndex(WAITING_TRIGGER)];
+#endif
+      // Earliest deadline reached, wake the timed lidars due
+      Mask timed = timedMask();
+      bool expired = false;
+      if (timed) {
+        unsigned long now = micros();
+        expired = (long) (now - nextWake) >= 0;
+        for (uint8_t i = 0; expired and timed; i++, timed >>= 1) {
+          if ((timed & 1) and (long) (now - deadline[i]) >= 0)
+            visit |= (Mask) 1 << i;
+        }
+      }
       // Handling routine
-      //for (int8_t i = count - 1; i >= 0; i--) {
-      for(uint8_t i = 0; i < count; i++){
+      for (uint8_t i = 0; visit; i++, visit >>= 1) {
+        if (!(visit & 1))
+          continue;
 #if PRINT_DEBUG_INFO
         Serial.print("Laser ");
         Serial.print(i);
 #endif
-        uint8_t strength = 0;
         switch (getState(i)) {
           
           case ACQUISITION_IN_PROGRESS: 
 #if PRINT_DEBUG_INFO
             Serial.println(" ACQUISITION_IN_PROGRESS ");
 #endif
-            // Get the status bit, if 0 => Acquisition is done
-            if (bitRead( status(i), 0) == 0) {
-              async(i, biasCorrection); // launch next measure before reading our measure. 
-              
-              lidars[i]->last_distance = lidars[i]->distance;            
-              distance(i, &lidars[i]->distance);
-#if ENABLE_STRENGTH_MEASURE
-              signalStrength(i, &lidars[i]->strength);
-#endif
-#if PRINT_DEBUG_INFO
-              Serial.println(i);
-              Serial.println(lidars[i]->distance);
-#endif
-              if((abs(lidars[i]->distance - lidars[i]->last_distance) > ERROR_MAX_DIFF_VALUE) | (lidars[i]->distance < ERROR_MIN_VALUE or lidars[i]->distance > ERROR_MAX_VALUE)){
-                shouldIncrementNack(i, 1);
+            // PWM lasers measure continuously, no I2C transaction
+            if (lidars[i]->isPWM()) {
+              pwmStep(i);
+              break;
+            }
+#if ENABLE_I2C_QUEUE
+            // The status read is queued, the answer comes in statusRead()
+            // With the status pin, the acquisition is queued once the pin is low
+            if (!lidars[i]->queued and lidars[i]->checkMeasurePeriod()) {
+              if (lidars[i]->statusPin) {
+                if (isReady(i))
+                  lidars[i]->queued = queueMeasure(i);
+                else if (lidars[i]->checkLastMeasure())
+                  recover(i);
+              } else if (bus(i).enqueueRead(addresses[i], REG_STATUS, 1, &onStatusRead, this, i)) {
+                lidars[i]->queued = true;
               }
+            }
+#else
+            // Get the status bit (or the mode pin), if 0 => Acquisition is done
+            // Free running lasers are read once per measure period, never triggered
+            if (lidars[i]->checkMeasurePeriod() and isReady(i)) {
+              // Timestamp of the measure, its trigger (the read for free running lasers)
+              lidars[i]->sampleTime = lidars[i]->isFreeRunning() ? micros() : lidars[i]->triggerTime;
+              if (lidars[i]->isFreeRunning())
+                lidars[i]->measureRead();
+              // launch next measure before reading our measure, scheduled and
+              // synchronized lasers wait for their trigger in WAITING_TRIGGER
+              if (!lidars[i]->isFreeRunning() and !waitsTrigger(i))
+                async(i, nextBias(i));
               
-              lidars[i]->notify_distance();
+              if (lidars[i]->mode & VELOCITY) {
+                int8_t newVelocity = 0;
+                if (!velocity(i, &newVelocity))
+                  processVelocity(i, newVelocity);
+              }
+              if (lidars[i]->mode != VELOCITY) {
+                int16_t newDistance = lidars[i]->distance;
+                readMeasurement(i, &newDistance);
+                processMeasure(i, newDistance);
+              }
 #if FORCE_RESET_OFFSET
-              setOffset(i, 0x00);
+              if (lidars[i]->capabilities & CAPABILITY_RESET_OFFSET)
+                setOffset(i, lidars[i]->offset);
 #endif
-              lidars[i]->lastMeasureTime = micros();
+              if (waitsTrigger(i) and getState(i) == ACQUISITION_IN_PROGRESS)
+                waitTrigger(i);
             } else {
               if(lidars[i]->checkLastMeasure()){
-                setState(i, SHUTING_DOWN);
+                recover(i);
               }
             }
+#endif
             break;
             
+          case WAITING_TRIGGER:
+#if PRINT_DEBUG_INFO
+            Serial.println(" WAITING_TRIGGER");
+#endif
+            // Triggered on its tick, the timeout timer starts at the trigger.
+            // Synchronized lasers are triggered together by synchronizedStep()
+            if (isSynchronized(i))
+              break;
+            if (isDue(i)) {
+              if (trigger(i)) {
+                clearDue(i);
+                lidars[i]->lastMeasureTime = micros();
+                setState(i, ACQUISITION_IN_PROGRESS);
+              } else {
+                // Queue full, retry on the next spin
+                raiseDue();
+              }
+            }
+            break;
+
           case NEED_RESET:
 #if PRINT_DEBUG_INFO
             Serial.println(" NEED_RESET");
 #endif
-            if (!resetOngoing) {
+            if (canReset(i)) {
               preReset(i);
               setState(i, RESET_PENDING);
             }
@@ -552,10 +1128,7 @@ class LidarController {
             // Check the timer, if done, laser is ready to reset, change state
             if (lidars[i]->checkTimer()) {
               postReset(i);
-              configure(i, lidars[i]->configuration);
-              async(i);
-              lidars[i]->lastMeasureTime = micros();
-              setState(i, ACQUISITION_IN_PROGRESS);
+              startLidar(i);
             }
             break;
 
@@ -571,16 +1144,859 @@ class LidarController {
             break;
         } // End switch case
 
-        if(checkNacks(i)){
-           //resetLidar(i);
+        // Lidars already resetting only get their counter cleared
+        if(checkNacks(i) and getState(i) == ACQUISITION_IN_PROGRESS){
+          recover(i);
         }
       } // End for each laser
+      if (expired)
+        refreshWake();
+#if ENABLE_I2C_QUEUE
+      for (uint8_t b = 0; b < busCount; b++)
+        busList[b]->processQueue();
+#endif
+      if (syncMask)
+        synchronizedStep();
+      else if (updated)
+        endCycle(frameDistance[1 - front], frameStrength[1 - front], frameState[1 - front], micros());
+#if ENABLE_STATISTICS
+      spinStatistics.record(micros() - spinStart);
+#endif
+    };
+
+#if ENABLE_STATISTICS
+    /*******************************************************************************
+      resetStatistics: Clear the statistics of the controller, of the lidars and
+      of their buses
+    *******************************************************************************/
+    void resetStatistics() {
+      unsigned long now = micros();
+      spinStatistics.reset();
+      for (uint8_t i = 0; i < count; i++)
+        lidarStatistics[i].reset(now);
+      for (uint8_t b = 0; b < busCount; b++)
+        busList[b]->statistics.reset();
+    };
+#endif
+
+    /*******************************************************************************
+      processMeasure: Store a new distance, check its coherence and health,
+      filter it (ENABLE_FILTER), notify the sink and restart the timeout timer
+
+        The health flags come from the status read before the measure (none
+        with the status pin or PWM) and the limits of the Lidar (LidarObject::setLimits).
+        Only HEALTH_ERRORS count in the error score, a measure without signal
+        is rejected without error: nothing in range is not a faulty laser
+    *******************************************************************************/
+    void processMeasure(uint8_t Lidar, int16_t newDistance) {
+      LidarObject * lidar = lidars[Lidar];
+      bool previousValid = !(lidar->health & (HEALTH_NO_SIGNAL | HEALTH_OUT_OF_RANGE));
+      lidar->last_distance = lidar->distance;
+      lidar->distance = newDistance;
+#if PRINT_DEBUG_INFO
+      Serial.println(Lidar);
+      Serial.println(lidar->distance);
+#endif
+      uint8_t health = lidar->hasStatus() ? lidarHealth(lidar->status) : (uint8_t) HEALTH_OK;
+      if (!(health & HEALTH_NO_SIGNAL)) {
+        if (newDistance < lidar->minDistance or newDistance > lidar->maxDistance)
+          health |= HEALTH_OUT_OF_RANGE;
+        else if (previousValid and abs(newDistance - lidar->last_distance) > lidar->maxJump)
+          health |= HEALTH_JUMP;
+      }
+      lidar->health = health;
+      bool incoherent = health & (HEALTH_ERRORS | HEALTH_NO_SIGNAL);
+      if (health & HEALTH_ERRORS)
+        shouldIncrementNack(Lidar, 1);
+      else if (lidar->nacksCount > 0)
+        lidar->nacksCount--;
+      if(lidars[Lidar]->configuration == ADAPTIVE_CONFIGURATION)
+        adapt(Lidar, incoherent);
+#if ENABLE_FILTER
+      // Incoherent measures do not reach the filter output
+      if(incoherent)
+        lidars[Lidar]->filtered_distance = lidars[Lidar]->filter.reject();
+      else
+        lidars[Lidar]->filtered_distance = lidars[Lidar]->filter.update(newDistance, lidars[Lidar]->strength, lidars[Lidar]->sampleTime);
+#endif
+
+      lidars[Lidar]->lastMeasureTime = micros();
+      frameDistance[1 - front][Lidar] = newDistance;
+      frameStrength[1 - front][Lidar] = lidars[Lidar]->strength;
+#if ENABLE_STATISTICS
+      lidarStatistics[Lidar].samples++;
+#endif
+#if ENABLE_SAMPLE_BUFFER
+      LidarSample sample = {lidars[Lidar]->distance, lidars[Lidar]->strength,
+        lidars[Lidar]->status, lidars[Lidar]->sampleTime};
+      lidars[Lidar]->samples.push(sample);
+#endif
+      updated |= (Mask) 1 << Lidar;
+      Sink::measure(lidars[Lidar]);
+    };
+
+    /*******************************************************************************
+      trigger: Start the acquisition of a scheduled Lidar. With ENABLE_I2C_QUEUE,
+      it is queued and the Lidar is not polled until the trigger is executed
+
+      returns false if it could not be queued (queue full)
+    *******************************************************************************/
+    bool trigger(uint8_t Lidar) {
+      bool powerOn = lidars[Lidar]->powerSave;
+#if ENABLE_I2C_QUEUE
+      if (bus(Lidar).queueSpace() < 1 + powerOn)
+        return false;
+      if (powerOn)
+        bus(Lidar).enqueueWrite(addresses[Lidar], REG_POWER_CONTROL, DATA_POWER_ON, &onNackOnly, this, Lidar);
+      bus(Lidar).enqueueWrite(addresses[Lidar], REG_ACQ_COMMAND,
+        nextBias(Lidar) ? DATA_MEASURE_WITH_BIAS : DATA_MEASURE_WITHOUT_BIAS, &onScheduledTrigger, this, Lidar);
+      lidars[Lidar]->queued = true;
+      return true;
+#else
+      if (powerOn)
+        powerControl(Lidar, DATA_POWER_ON);
+      async(Lidar, nextBias(Lidar));
+      return true;
+#endif
+    };
+
+    /*******************************************************************************
+      waitTrigger: A scheduled or synchronized Lidar has been read, it waits for
+      its trigger in WAITING_TRIGGER, with the receiver off if powerSave
+    *******************************************************************************/
+    void waitTrigger(uint8_t Lidar) {
+      setState(Lidar, WAITING_TRIGGER);
+      // Ticked while acquiring, the dueEvent of that tick is already consumed
+      if (!isSynchronized(Lidar) and isDue(Lidar))
+        raiseDue();
+      if (!lidars[Lidar]->powerSave)
+        return;
+#if ENABLE_I2C_QUEUE
+      // Best effort, the receiver stays on if the queue is full
+      bus(Lidar).enqueueWrite(addresses[Lidar], REG_POWER_CONTROL, DATA_POWER_RECEIVER_OFF, &onNackOnly, this, Lidar);
+#else
+      powerControl(Lidar, DATA_POWER_RECEIVER_OFF);
+#endif
+    };
+
+    /*******************************************************************************
+      powerControl: Write REG_POWER_CONTROL (DATA_POWER_*), blocking
+
+        returns the nack error (0 if no error)
+    *******************************************************************************/
+    uint8_t powerControl(uint8_t Lidar, uint8_t data) {
+      uint8_t nack = bus(Lidar).write(addresses[Lidar], REG_POWER_CONTROL, data);
+      shouldIncrementNack(Lidar, nack);
+      return nack;
+    };
+
+    /*******************************************************************************
+      park: Stop the acquisitions of an addressed Lidar and save its power,
+      without the power cycle and the 20ms reset of the enable pin
+
+        sleep: false turns the receiver off (fast wake), true puts the Lidar
+        in device sleep (less current, the configuration is written again on
+        wake)
+
+      A parked Lidar stays in PARKED and costs nothing to spinOnce() until
+      wake(). returns false if the Lidar is not acquiring (resetting or already
+      parked), free running, has queued transactions or did not answer
+    *******************************************************************************/
+    bool park(uint8_t Lidar, bool sleep = false) {
+      LIDAR_STATE state = getState(Lidar);
+      if (state != ACQUISITION_IN_PROGRESS and state != WAITING_TRIGGER)
+        return false;
+      if (lidars[Lidar]->isFreeRunning() or lidars[Lidar]->queued)
+        return false;
+      if (powerControl(Lidar, sleep ? DATA_POWER_SLEEP : DATA_POWER_RECEIVER_OFF))
+        return false;
+      if (lidars[Lidar]->isPWM())
+        lidars[Lidar]->disable();
+      lidars[Lidar]->sleeping = sleep;
+      setState(Lidar, PARKED);
+      return true;
+    };
+
+    /*******************************************************************************
+      wake: Turn a parked Lidar back on, at its address, and start a bias
+      corrected acquisition (scheduled and synchronized Lidars wait for their
+      trigger). The first write wakes a sleeping Lidar up, it is sent twice if
+      it is not acknowledged.
+
+        returns false if the Lidar is not parked, or did not answer: it is then
+        resetted
+    *******************************************************************************/
+    bool wake(uint8_t Lidar) {
+      if (getState(Lidar) != PARKED)
+        return false;
+      LidarObject * lidar = lidars[Lidar];
+      uint8_t nack = powerControl(Lidar, DATA_POWER_ON);
+      if (nack and lidar->sleeping)
+        nack = powerControl(Lidar, DATA_POWER_ON);
+      if (nack) {
+        resetLidar(Lidar);
+        return false;
+      }
+      if (lidar->sleeping)
+        configure(Lidar, lidar->configuration);
+      lidar->sleeping = false;
+      lidar->biasCount = 0;
+      lidar->lastMeasureTime = micros();
+      if (waitsTrigger(Lidar)) {
+        setState(Lidar, WAITING_TRIGGER);
+        raiseDue();
+      } else {
+        startAcquisition(Lidar);
+        setState(Lidar, ACQUISITION_IN_PROGRESS);
+      }
+      return true;
+    };
+
+    /*******************************************************************************
+      startAcquisition: First acquisition after a reset, a recovery or a wake: an
+      async() over I2C, or the trigger pin pulled low for a PWM Lidar (it then
+      measures continuously)
+    *******************************************************************************/
+    void startAcquisition(uint8_t Lidar, bool bias = true) {
+      if (lidars[Lidar]->isPWM())
+        lidars[Lidar]->enable();
+      else
+        async(Lidar, bias);
+    };
+
+    /*******************************************************************************
+      pwmStep: Process the newest pulse of a PWM Lidar (LidarObject::pwmEdge), or
+      recover it after its timeout without pulse
+    *******************************************************************************/
+    void pwmStep(uint8_t Lidar) {
+      int16_t newDistance;
+      unsigned long time;
+      if (lidars[Lidar]->pwmRead(&newDistance, &time)) {
+        lidars[Lidar]->sampleTime = time;
+        processMeasure(Lidar, newDistance);
+      } else if (lidars[Lidar]->checkLastMeasure()) {
+        recover(Lidar);
+      }
+    };
+
+#if ENABLE_SCHEDULER
+    /*******************************************************************************
+      schedule: Trigger the Lidar every period µs (rounded to SCHEDULER_TICK_US)
+      instead of as fast as possible, 0 to stop scheduling it
+
+      The trigger is sent by the first spinOnce() after the tick, so it keeps
+      the loop latency; the measure is timestamped at that trigger (sampleTime),
+      not at the tick. The scheduled lidars are staggered over their period to
+      spread the bus load. Free running lidars (CONTINUOUS_I2C_TYPE or velocity
+      mode) are not triggered, they can not be scheduled.
+    *******************************************************************************/
+    void schedule(uint8_t Lidar, unsigned long period) {
+      uint16_t ticks = period / SCHEDULER_TICK_US;
+      if (period and ticks == 0)
+        ticks = 1;
+      noInterrupts();
+      periodTicks[Lidar] = lidars[Lidar]->isFreeRunning() or lidars[Lidar]->isPWM() ? 0 : ticks;
+      due[Lidar] = false;
+      // A lidar no longer scheduled is due at once
+      dueEvent = true;
+      // Spread the phases of the scheduled lidars over their period
+      uint8_t scheduled = 0;
+      for (uint8_t i = 0; i < N; i++)
+        scheduled += periodTicks[i] != 0;
+      uint8_t k = 0;
+      for (uint8_t i = 0; i < N; i++) {
+        if (periodTicks[i])
+          countdown[i] = 1 + (uint32_t) periodTicks[i] * k++ / scheduled;
+      }
+      interrupts();
+    };
+
+    /*******************************************************************************
+      tick: Call it every SCHEDULER_TICK_US, from a timer interrupt (see 
+      beginSchedulerTimer) or from the loop. It only flags the lidars due for a 
+      trigger, the I2C transactions stay in spinOnce() since Wire needs the 
+      interrupts.
+    *******************************************************************************/
+    void tick() {
+      for (uint8_t i = 0; i < N; i++) {
+        if (periodTicks[i] and --countdown[i] == 0) {
+          countdown[i] = periodTicks[i];
+          due[i] = true;
+          dueEvent = true;
+        }
+      }
+    };
+
+#if defined(__AVR__) and defined(TIMSK1)
+    /*******************************************************************************
+      beginSchedulerTimer: Run Timer1 in CTC mode every SCHEDULER_TICK_US (at 
+      most 262ms at 16MHz). The sketch then calls tick() from its interrupt:
+        ISR(TIMER1_COMPA_vect) { Controller.tick(); }
+    *******************************************************************************/
+    static void beginSchedulerTimer() {
+      noInterrupts();
+      TCCR1A = 0;
+      TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10); // CTC, prescaler 64
+      TCNT1 = 0;
+      OCR1A = (F_CPU / 64UL / 1000UL) * SCHEDULER_TICK_US / 1000UL - 1;
+      TIMSK1 |= _BV(OCIE1A);
+      interrupts();
+    };
+#endif
+#endif
+
+    /*******************************************************************************
+      timedMask: lidars waiting for a deadline (SHUTING_DOWN, RESET_PENDING)
+    *******************************************************************************/
+    inline Mask timedMask() {
+      return stateMask[lidarStateIndex(SHUTING_DOWN)] | stateMask[lidarStateIndex(RESET_PENDING)];
+    };
+
+    /*******************************************************************************
+      refreshWake: nextWake is the earliest deadline of the timed lidars
+    *******************************************************************************/
+    void refreshWake() {
+      Mask timed = timedMask();
+      bool first = true;
+      for (uint8_t i = 0; timed; i++, timed >>= 1) {
+        if ((timed & 1) and (first or (long) (deadline[i] - nextWake) < 0)) {
+          nextWake = deadline[i];
+          first = false;
+        }
+      }
+    };
+
+    /*******************************************************************************
+      raiseDue: visit the WAITING_TRIGGER lidars on the next spinOnce()
+    *******************************************************************************/
+    inline void raiseDue() {
+#if ENABLE_SCHEDULER
+      dueEvent = true;
+#endif
+    };
+
+    /*******************************************************************************
+      isScheduled: returns true if the Lidar is triggered by the scheduler
+    *******************************************************************************/
+    inline bool isScheduled(uint8_t Lidar) {
+#if ENABLE_SCHEDULER
+      return periodTicks[Lidar] != 0;
+#else
+      (void) Lidar;
+      return false;
+#endif
+    };
+
+    /*******************************************************************************
+      isDue: returns true if the scheduled Lidar has to be triggered. A lidar no
+      longer scheduled is always due.
+    *******************************************************************************/
+    inline bool isDue(uint8_t Lidar) {
+#if ENABLE_SCHEDULER
+      return periodTicks[Lidar] == 0 or due[Lidar];
+#else
+      (void) Lidar;
+      return true;
+#endif
+    };
+
+    /*******************************************************************************
+      clearDue: the Lidar has been triggered, wait for its next tick
+    *******************************************************************************/
+    inline void clearDue(uint8_t Lidar) {
+#if ENABLE_SCHEDULER
+      due[Lidar] = false;
+#else
+      (void) Lidar;
+#endif
+    };
+
+    /*******************************************************************************
+      setCallbackFrame: Called once per cycle with the results of all the lidars,
+      after the spinOnce() with new measures, or once per frame of the
+      synchronized group (see LidarCycle). NULL to remove it.
+    *******************************************************************************/
+    void setCallbackFrame(void (*_callback)(const LidarCycle & cycle)) {
+      frameCallback = _callback;
+    };
+
+    /*******************************************************************************
+      endCycle: Give the results of the cycle to the sink and to the frame
+      callback, then forget the lidars updated
+    *******************************************************************************/
+    void endCycle(const int16_t * distances, const uint8_t * strengths, const uint8_t * states, unsigned long time) {
+      LidarCycle cycle = {distances, strengths, states, updated, count, time};
+      updated = 0;
+      Sink::frame(cycle);
+      if (frameCallback)
+        frameCallback(cycle);
+    };
+
+    /*******************************************************************************
+      synchronize: Add the Lidar to (or remove it from) the synchronized group
+
+      The lidars of the group are triggered together by their trigger pin (a
+      low pulse on the mode pin, through a 1k resistor), in one write per GPIO
+      port, once all of them have been read. Their measures share the trigger
+      time (sampleTime) and are published as one frame: the controller calls
+      swapBuffers() itself when a frame is complete, see syncFrame() and
+      frameTime(). Do not call swapBuffers() while a group is used.
+
+      A lidar back from a reset starts with an I2C trigger of its own and
+      joins the group on its next frame.
+
+      returns false for a lidar which can not be triggered by its pin: free 
+      running, or using its mode pin as status output (beginStatusPin)
+    *******************************************************************************/
+    bool synchronize(uint8_t Lidar, bool enabled = true) {
+      Mask bit = (Mask) 1 << Lidar;
+      if (!enabled) {
+        syncMask &= ~bit;
+        return true;
+      }
+      if (lidars[Lidar]->isFreeRunning() or lidars[Lidar]->statusPin or lidars[Lidar]->isPWM())
+        return false;
+      pinMode(lidars[Lidar]->TrigPin, OUTPUT);
+      lidars[Lidar]->disable();
+      syncMask |= bit;
+      return true;
+    };
+
+    /*******************************************************************************
+      isSynchronized: returns true if the Lidar is in the synchronized group
+    *******************************************************************************/
+    inline bool isSynchronized(uint8_t Lidar) {
+      return syncMask & ((Mask) 1 << Lidar);
+    };
+
+    /*******************************************************************************
+      waitsTrigger: returns true if the Lidar waits in WAITING_TRIGGER after a
+      read instead of being triggered again at once (scheduled or synchronized)
+    *******************************************************************************/
+    inline bool waitsTrigger(uint8_t Lidar) {
+      return isScheduled(Lidar) or isSynchronized(Lidar);
+    };
+
+    /*******************************************************************************
+      syncFrame: returns true once per frame of the synchronized group, the
+      frame is then the front frame (frameDistances()...) until the next one
+
+      frameTime: micros() of the trigger of the front frame
+    *******************************************************************************/
+    bool syncFrame() {
+      bool published = syncPublished;
+      syncPublished = false;
+      return published;
     };
 
-    LidarObject* lidars[MAX_LIDARS];
+    inline unsigned long frameTime() {
+      return syncFrameTime;
+    };
+
+    /*******************************************************************************
+      setExternalTrigger: the group is triggered by requestFrame() (an external
+      sync line, see LidarLink.h) instead of as soon as it is read. The frame is
+      still published once read, the next trigger waits for the request
+
+      requestFrame: trigger the next frame as soon as the group is read
+    *******************************************************************************/
+    void setExternalTrigger(bool enabled = true) {
+      syncExternal = enabled;
+      syncRequested = false;
+    };
+
+    inline void requestFrame() {
+      syncRequested = true;
+    };
+
+    /*******************************************************************************
+      synchronizedStep: once no lidar of the group is acquiring, publish the
+      frame and trigger the lidars waiting, all at once
+    *******************************************************************************/
+    void synchronizedStep() {
+      Mask waiting = stateMask[lidarStateIndex(WAITING_TRIGGER)] & syncMask;
+      if ((stateMask[lidarStateIndex(ACQUISITION_IN_PROGRESS)] & syncMask) or !waiting)
+        return;
+      if (syncTriggered) {
+        swapBuffers();
+        syncFrameTime = syncTriggerTime;
+        syncPublished = true;
+        syncTriggered = false;
+        endCycle(frameDistances(), frameStrengths(), frameStates(), syncFrameTime);
+      }
+      if (syncExternal) {
+        if (!syncRequested)
+          return;
+        syncRequested = false;
+      }
+      // Receivers on before the pulse, a queued write would come after it
+      Mask powered = waiting;
+      for (uint8_t i = 0; powered; i++, powered >>= 1) {
+        if ((powered & 1) and lidars[i]->powerSave)
+          powerControl(i, DATA_POWER_ON);
+      }
+      syncTriggerTime = triggerGroup(waiting);
+      syncTriggered = true;
+      for (uint8_t i = 0; waiting; i++, waiting >>= 1) {
+        if (waiting & 1) {
+          lidars[i]->triggerTime = syncTriggerTime;
+          lidars[i]->lastMeasureTime = syncTriggerTime;
+          setState(i, ACQUISITION_IN_PROGRESS);
+        }
+      }
+    };
+
+    /*******************************************************************************
+      triggerGroup: Pulse the trigger pins of the lidars low, with one write per
+      GPIO port when the core gives access to the port registers (one
+      digitalWrite() per lidar otherwise)
+
+      returns the micros() of the trigger
+    *******************************************************************************/
+    unsigned long triggerGroup(Mask group) {
+#if defined(portOutputRegister) and defined(digitalPinToPort) and defined(digitalPinToBitMask)
+      typedef decltype(portOutputRegister(digitalPinToPort(0))) PortRegister;
+      typedef decltype(digitalPinToBitMask(0)) PortMask;
+      PortRegister ports[N];
+      PortMask masks[N];
+      uint8_t portCount = 0;
+      Mask m = group;
+      for (uint8_t i = 0; m; i++, m >>= 1) {
+        if (!(m & 1))
+          continue;
+        uint8_t pin = lidars[i]->TrigPin;
+        PortRegister out = portOutputRegister(digitalPinToPort(pin));
+        uint8_t p = 0;
+        while (p < portCount and ports[p] != out)
+          p++;
+        if (p == portCount) {
+          ports[portCount] = out;
+          masks[portCount++] = 0;
+        }
+        masks[p] |= digitalPinToBitMask(pin);
+      }
+      unsigned long now = micros();
+      noInterrupts();
+      for (uint8_t p = 0; p < portCount; p++)
+        *ports[p] &= ~masks[p];
+      delayMicroseconds(SYNC_TRIGGER_PULSE_US);
+      for (uint8_t p = 0; p < portCount; p++)
+        *ports[p] |= masks[p];
+      interrupts();
+#else
+      unsigned long now = micros();
+      Mask m = group;
+      for (uint8_t i = 0; m; i++, m >>= 1) {
+        if (m & 1)
+          lidars[i]->enable();
+      }
+      delayMicroseconds(SYNC_TRIGGER_PULSE_US);
+      m = group;
+      for (uint8_t i = 0; m; i++, m >>= 1) {
+        if (m & 1)
+          lidars[i]->disable();
+      }
+#endif
+      return now;
+    };
+
+    /*******************************************************************************
+      adapt: ADAPTIVE_CONFIGURATION, choose the fastest level of ADAPTIVE_LEVELS
+      the target supports, once every ADAPTIVE_WINDOW measures
+
+        * one level slower if the average strength is under ADAPTIVE_STRENGTH_LOW,
+        if the average distance is over the range of the level or if more than
+        ADAPTIVE_MAX_FAILURES measures were incoherent
+        * one level faster if none failed, the average strength is over 
+        ADAPTIVE_STRENGTH_HIGH and the average distance is under 3/4 of the range
+        of the faster level
+        * otherwise (hysteresis band) the level is kept
+    *******************************************************************************/
+    void adapt(uint8_t Lidar, bool incoherent) {
+      LidarObject * lidar = lidars[Lidar];
+      if (incoherent)
+        lidar->adaptiveFailures++;
+      else {
+        lidar->adaptiveStrength += lidar->strength;
+        lidar->adaptiveDistance += lidar->distance;
+      }
+      if (++lidar->adaptiveCount < ADAPTIVE_WINDOW)
+        return;
+      uint8_t valid = ADAPTIVE_WINDOW - lidar->adaptiveFailures;
+      uint8_t strength = valid ? lidar->adaptiveStrength / valid : 0;
+      uint16_t range = valid ? lidar->adaptiveDistance / valid : 0;
+      uint8_t level = lidar->adaptiveLevel;
+      if (lidar->adaptiveFailures > ADAPTIVE_MAX_FAILURES or strength < ADAPTIVE_STRENGTH_LOW
+          or range > ADAPTIVE_LEVELS[level].range) {
+        if (level + 1 < (int) ADAPTIVE_LEVELS_COUNT)
+          level++;
+      } else if (level > 0 and lidar->adaptiveFailures == 0 and strength > ADAPTIVE_STRENGTH_HIGH
+          and range < ADAPTIVE_LEVELS[level - 1].range / 4 * 3) {
+        level--;
+      }
+      lidar->adaptiveCount = 0;
+      lidar->adaptiveFailures = 0;
+      lidar->adaptiveStrength = 0;
+      lidar->adaptiveDistance = 0;
+      if (level == lidar->adaptiveLevel)
+        return;
+#if ENABLE_I2C_QUEUE
+      // Decided again on the next window if it can not be queued now
+      if (bus(Lidar).queueSpace() < 2)
+        return;
+#endif
+      lidar->adaptiveLevel = level;
+      // Used from the next acquisition on
+#if ENABLE_I2C_QUEUE
+      bus(Lidar).enqueueWrite(addresses[Lidar], REG_SIG_CONT_VAL, ADAPTIVE_LEVELS[level].sigCount, &onNackOnly, this, Lidar);
+      bus(Lidar).enqueueWrite(addresses[Lidar], REG_THRESHOLD_BYPASS, ADAPTIVE_LEVELS[level].threshold, &onNackOnly, this, Lidar);
+#else
+      shouldIncrementNack(Lidar, bus(Lidar).write(addresses[Lidar], REG_SIG_CONT_VAL, ADAPTIVE_LEVELS[level].sigCount));
+      shouldIncrementNack(Lidar, bus(Lidar).write(addresses[Lidar], REG_THRESHOLD_BYPASS, ADAPTIVE_LEVELS[level].threshold));
+#endif
+    };
+
+    /*******************************************************************************
+      processVelocity: Store a new velocity (REG_VELOCITY count) in m/s, notify the
+      sink with the time since the last velocity and restart the timeout timer
+    *******************************************************************************/
+    void processVelocity(uint8_t Lidar, int8_t newVelocity) {
+      LidarObject * lidar = lidars[Lidar];
+      unsigned long now = micros();
+      unsigned long dt = now - lidar->velocityTime;
+      lidar->velocity = newVelocity * lidar->velocityScale();
+      lidar->velocityTime = now;
+      lidar->lastMeasureTime = now;
+#if ENABLE_STATISTICS
+      // Counted with the distance in DISTANCE_AND_VELOCITY
+      if (lidar->mode == VELOCITY)
+        lidarStatistics[Lidar].samples++;
+#endif
+      // The error score decays on a good read, done by processMeasure() unless
+      // the velocity is the only measure
+      if (lidar->mode == VELOCITY and lidar->nacksCount > 0)
+        lidar->nacksCount--;
+      updated |= (Mask) 1 << Lidar;
+      Sink::velocity(lidar, dt);
+    };
+
+    /*******************************************************************************
+      swapBuffers: Publish the last measure of every laser as one frame
+
+      The measures are written in a back frame, swapBuffers() makes it the
+      front frame read through frameDistances(), frameStrengths() and 
+      frameStates(). Those N elements arrays do not change until the next
+      swapBuffers(), a message can point to them without copying and without
+      mixing lasers of two spins. Call it from the same context as spinOnce().
+    *******************************************************************************/
+    void swapBuffers() {
+      front = 1 - front;
+      // The new back frame starts from the published one, lasers without a new
+      // measure keep their last value
+      memcpy(frameDistance[1 - front], frameDistance[front], sizeof(frameDistance[0]));
+      memcpy(frameStrength[1 - front], frameStrength[front], sizeof(frameStrength[0]));
+      memcpy(frameState[1 - front], frameState[front], sizeof(frameState[0]));
+    };
+
+    /*******************************************************************************
+      frameDistances, frameStrengths, frameStates: front frame (see swapBuffers),
+      contiguous arrays of N elements (getCount() used), indexed by laser id
+    *******************************************************************************/
+    inline int16_t * frameDistances() {
+      return frameDistance[front];
+    };
+
+    inline uint8_t * frameStrengths() {
+      return frameStrength[front];
+    };
+
+    inline uint8_t * frameStates() {
+      return frameState[front];
+    };
+
+#if ENABLE_I2C_QUEUE
+    /*******************************************************************************
+      statusRead: Queued status answer. If the acquisition is done, queue the
+      next acquisition and the reading of the measure (queueMeasure)
+
+      Callbacks check the state, the laser could be resetted in the meantime
+    *******************************************************************************/
+    void statusRead(uint8_t Lidar, I2CTransaction * transaction) {
+      shouldIncrementNack(Lidar, transaction->nack);
+      if (getState(Lidar) != ACQUISITION_IN_PROGRESS) {
+        lidars[Lidar]->queued = false;
+        return;
+      }
+      if (!transaction->nack)
+        lidars[Lidar]->status = transaction->data[0];
+      if (transaction->nack or bitRead(transaction->data[0], 0) or !queueMeasure(Lidar)) {
+        lidars[Lidar]->queued = false;
+        if (lidars[Lidar]->checkLastMeasure())
+          recover(Lidar);
+      }
+    };
+
+    /*******************************************************************************
+      queueMeasure: Queue the next acquisition and the reading of the measure
+
+      Chain: trigger, velocity, measure, offset (the last read ends the chain),
+      free running lasers are not triggered
+      returns false if the queue has not enough space for the whole chain
+    *******************************************************************************/
+    bool queueMeasure(uint8_t Lidar) {
+      bool continuous = lidars[Lidar]->isFreeRunning();
+      bool retrigger = !continuous and !waitsTrigger(Lidar);
+      bool readVelocity = lidars[Lidar]->mode & VELOCITY;
+      bool readDistance = lidars[Lidar]->mode != VELOCITY;
+      bool resetOffset = FORCE_RESET_OFFSET and (lidars[Lidar]->capabilities & CAPABILITY_RESET_OFFSET);
+      if (bus(Lidar).queueSpace() < retrigger + readVelocity + readDistance + resetOffset)
+        return false;
+      uint8_t address = addresses[Lidar];
+      lidars[Lidar]->sampleTime = continuous ? micros() : lidars[Lidar]->triggerTime;
+      if (continuous)
+        lidars[Lidar]->measureRead();
+      // launch next measure before reading our measure, scheduled and
+      // synchronized lasers wait for their trigger in WAITING_TRIGGER
+      if (retrigger)
+        bus(Lidar).enqueueWrite(address, REG_ACQ_COMMAND,
+          nextBias(Lidar) ? DATA_MEASURE_WITH_BIAS : DATA_MEASURE_WITHOUT_BIAS, &onTrigger, this, Lidar);
+      if (readVelocity)
+        bus(Lidar).enqueueRead(address, REG_VELOCITY, 1, &onVelocityRead, this, Lidar);
+      if (readDistance) {
+#if ENABLE_STRENGTH_MEASURE
+        bus(Lidar).enqueueRead(address, STRENGTH_AND_VALUE_REGISTER, 3, &onMeasureRead, this, Lidar);
+#else
+        bus(Lidar).enqueueRead(address, MEASURED_VALUE_REGISTER, 2, &onMeasureRead, this, Lidar);
+#endif
+      }
+      if (resetOffset)
+        bus(Lidar).enqueueWrite(address, REG_OFFSET_REGISTER, lidars[Lidar]->offset);
+      return true;
+    };
+
+    /*******************************************************************************
+      measureRead: Queued measure answer, ends the acquisition started by statusRead
+    *******************************************************************************/
+    void measureRead(uint8_t Lidar, I2CTransaction * transaction) {
+      lidars[Lidar]->queued = false;
+      shouldIncrementNack(Lidar, transaction->nack);
+      if (transaction->nack or getState(Lidar) != ACQUISITION_IN_PROGRESS)
+        return;
+#if ENABLE_STRENGTH_MEASURE
+      lidars[Lidar]->strength = transaction->data[0];
+      processMeasure(Lidar, (transaction->data[1] << 8) + transaction->data[2]);
+#else
+      processMeasure(Lidar, (transaction->data[0] << 8) + transaction->data[1]);
+#endif
+      if (waitsTrigger(Lidar) and getState(Lidar) == ACQUISITION_IN_PROGRESS)
+        waitTrigger(Lidar);
+    };
+
+    /*******************************************************************************
+      velocityRead: Queued velocity answer, ends the chain in mode VELOCITY
+    *******************************************************************************/
+    void velocityRead(uint8_t Lidar, I2CTransaction * transaction) {
+      if (lidars[Lidar]->mode == VELOCITY)
+        lidars[Lidar]->queued = false;
+      shouldIncrementNack(Lidar, transaction->nack);
+      if (transaction->nack or getState(Lidar) != ACQUISITION_IN_PROGRESS)
+        return;
+      processVelocity(Lidar, (int8_t) transaction->data[0]);
+    };
+
+    /*******************************************************************************
+      triggerDone: Queued trigger answer, the measure starts now
+    *******************************************************************************/
+    void triggerDone(uint8_t Lidar, I2CTransaction * transaction) {
+      lidars[Lidar]->triggerTime = micros();
+      shouldIncrementNack(Lidar, transaction->nack);
+    };
+
+    static void onStatusRead(I2CTransaction * transaction) {
+      ((LidarControllerN *) transaction->context)->statusRead(transaction->tag, transaction);
+    };
+
+    static void onMeasureRead(I2CTransaction * transaction) {
+      ((LidarControllerN *) transaction->context)->measureRead(transaction->tag, transaction);
+    };
+
+    static void onVelocityRead(I2CTransaction * transaction) {
+      ((LidarControllerN *) transaction->context)->velocityRead(transaction->tag, transaction);
+    };
+
+    static void onTrigger(I2CTransaction * transaction) {
+      ((LidarControllerN *) transaction->context)->triggerDone(transaction->tag, transaction);
+    };
+
+    static void onScheduledTrigger(I2CTransaction * transaction) {
+      LidarControllerN * controller = (LidarControllerN *) transaction->context;
+      controller->triggerDone(transaction->tag, transaction);
+      controller->lidars[transaction->tag]->queued = false;
+    };
+
+    static void onNackOnly(I2CTransaction * transaction) {
+      ((LidarControllerN *) transaction->context)->shouldIncrementNack(transaction->tag, transaction->nack);
+    };
+#endif
+
+    LidarObject* lidars[N] = {NULL};
+#if ENABLE_STATISTICS
+    SpinStatistics spinStatistics = {};
+    LidarStatistics lidarStatistics[N];
+#endif
   private:
-    bool resetOngoing = false;
+    // Hot state machine data, dense per laser
+    uint8_t states[N];
+    uint8_t addresses[N];
+    uint8_t busIds[N];
+    // Published (front) and written (back) frames of the measures, see swapBuffers()
+    int16_t frameDistance[2][N] = {{0}};
+    uint8_t frameStrength[2][N] = {{0}};
+    uint8_t frameState[2][N] = {{0}};
+    uint8_t front = 0;
+#if ENABLE_SCHEDULER
+    // Written by schedule(), decremented by tick() (interrupt)
+    volatile uint16_t periodTicks[N] = {0};
+    volatile uint16_t countdown[N] = {0};
+    volatile bool due[N] = {false};
+    // Set by tick() when a lidar got due, the WAITING_TRIGGER lidars are visited
+    volatile bool dueEvent = false;
+#endif
+    // Lidars by state (bit i is the lidar i), indexed by lidarStateIndex
+    Mask stateMask[LIDAR_STATE_COUNT] = {0};
+    // Deadlines of the timed lidars and the earliest of them, see setState()
+    unsigned long deadline[N];
+    unsigned long nextWake = 0;
+    // A reset latch was released or a lidar needs a reset, visit NEED_RESET
+    bool resetEvent = false;
+    // Synchronized group, trigger time of its acquisition and of the front frame
+    Mask syncMask = 0;
+    unsigned long syncTriggerTime = 0;
+    unsigned long syncFrameTime = 0;
+    bool syncTriggered = false;
+    bool syncPublished = false;
+    // Triggered by requestFrame() only, see setExternalTrigger()
+    bool syncExternal = false;
+    bool syncRequested = false;
+    // Lidars with a new measure in the cycle, see endCycle()
+    Mask updated = 0;
+    void (*frameCallback)(const LidarCycle & cycle) = NULL;
+    // Buses used by the lidars, each one has its own reset latch
+    I2CFunctions * busList[MAX_I2C_BUSES];
+    bool resetOngoing[MAX_I2C_BUSES] = {false};
+    // Lidars addressed by serial, powered at the same time
+    uint8_t parallelResets[MAX_I2C_BUSES] = {0};
+    bool parallel[N];
+    uint8_t busCount = 0;
+    bool begun = false;
+    bool fastI2C = false;
+    bool biasCorrection = true;
     uint8_t count = 0;
+#if ENABLE_STORAGE
+    bool storageValid = false;  // The EEPROM record is valid, see save()
+#endif
 };
 
+typedef LidarControllerN<MAX_LIDARS> LidarController;
+
 #endif
@@ -0,0 +1,127 @@
+#ifndef LIDAR_CORRELATION_H
+#define LIDAR_CORRELATION_H
+
+#include <Arduino.h>
+
+// Points of the correlation record of the LidarLite v3
+#define CORRELATION_RECORD_LENGTH 256
+// Returns kept by LidarPeakFinder, the strongest ones
+#define CORRELATION_MAX_PEAKS     2
+
+/*******************************************************************************
+  LidarEcho : a peak of the correlation record
+
+  index is the point of the record (the delay, it grows with the distance),
+  value is the correlation at this point
+*******************************************************************************/
+struct LidarEcho {
+  uint16_t index;
+  int16_t value;
+};
+
+/*******************************************************************************
+  LidarPeakFinder : streaming peak finder for the correlation record
+
+  Fed one point at a time (add()), it never needs the whole record. It keeps
+  the CORRELATION_MAX_PEAKS strongest local maxima above threshold, two peaks
+  closer than separation points count as one (the strongest). first() is the
+  nearest of them, second() the farthest: on glass or foliage, first() is
+  the partial reflection and second() the target behind it.
+*******************************************************************************/
+class LidarPeakFinder {
+  public:
+/*******************************************************************************
+  begin : threshold, minimal value of a peak (the noise floor, REG_NOISE_PEAK,
+  is a good start), separation, minimal distance between two peaks in points
+*******************************************************************************/
+    void begin(int16_t _threshold = 0, uint8_t _separation = 8){
+      threshold = _threshold;
+      separation = _separation;
+      reset();
+    };
+
+/*******************************************************************************
+  reset : forget the peaks, the next point is the point 0 of a new record
+*******************************************************************************/
+    void reset(){
+      index = 0;
+      rising = false;
+      peaks = 0;
+    };
+
+/*******************************************************************************
+  add : process the next point of the record
+*******************************************************************************/
+    void add(int16_t value){
+      if(index > 0){
+        if(value > previous){
+          rising = true;
+        } else if(value < previous and rising){
+          // End of a rise (or of the plateau after it), the previous point is a peak
+          candidate(index - 1, previous);
+          rising = false;
+        }
+      }
+      previous = value;
+      index++;
+    };
+
+/*******************************************************************************
+  count : number of peaks found, 0 to CORRELATION_MAX_PEAKS
+*******************************************************************************/
+    uint8_t count(){
+      return peaks;
+    };
+
+/*******************************************************************************
+  first, second : the nearest and the farthest peak, second() is first() if
+  only one peak was found. Only valid if count() > 0
+*******************************************************************************/
+    LidarEcho first(){
+      return peaks > 1 and echoes[1].index < echoes[0].index ? echoes[1] : echoes[0];
+    };
+
+    LidarEcho second(){
+      return peaks > 1 and echoes[1].index > echoes[0].index ? echoes[1] : echoes[0];
+    };
+
+  private:
+    // Keep the strongest peaks, sorted by value, merge the close ones
+    void candidate(uint16_t i, int16_t value){
+      if(value < threshold)
+        return;
+      uint8_t slot = peaks;
+      for(uint8_t p = 0; p < peaks; p++){
+        if(i - echoes[p].index < separation){
+          if(value <= echoes[p].value)
+            return;
+          slot = p;
+          break;
+        }
+      }
+      if(slot == peaks){
+        if(peaks < CORRELATION_MAX_PEAKS)
+          peaks++;
+        else if(value <= echoes[peaks - 1].value)
+          return;
+        slot = peaks - 1;
+      }
+      // Insertion, moving the weaker peaks down
+      while(slot > 0 and echoes[slot - 1].value < value){
+        echoes[slot] = echoes[slot - 1];
+        slot--;
+      }
+      echoes[slot].index = i;
+      echoes[slot].value = value;
+    };
+
+    LidarEcho echoes[CORRELATION_MAX_PEAKS];
+    uint8_t peaks = 0;
+    int16_t threshold = 0;
+    uint8_t separation = 8;
+    uint16_t index = 0;
+    int16_t previous = 0;
+    bool rising = false;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef LIDAR_FILTER_H
+#define LIDAR_FILTER_H
+
+#include <Arduino.h>
+
+// Filter the distances of each laser (LidarObject::filter, filtered_distance)
+#ifndef ENABLE_FILTER
+#define ENABLE_FILTER             false
+#endif
+// Window of the running median, odd, at most 7
+#define LIDAR_MEDIAN_SIZE         5
+// Strength giving the nominal measurement noise of the Kalman filter
+#define LIDAR_FILTER_STRENGTH_REF 64
+// Longest time between two measures used by the alpha-beta filter (ms)
+#define LIDAR_FILTER_MAX_DT_MS    1000
+
+enum LIDAR_FILTER {
+  FILTER_NONE = 0,        // filtered_distance is the distance
+  FILTER_MEDIAN = 1,      // Running median of LIDAR_MEDIAN_SIZE measures
+  FILTER_ALPHA_BETA = 2,  // Position and velocity tracker
+  FILTER_KALMAN = 3       // 1D Kalman, constant position model, strength weighted
+};
+
+/*******************************************************************************
+  LidarFilter : integer filter of the distances of one laser
+
+  Everything is fixed point (Q8, 1/256 cm), no float. The alpha-beta update
+  divides by the time between the measures and the Kalman update by the
+  strength and the variance, a few 32 bit divisions per measure. Measures
+  under minStrength (and the incoherent ones, see
+  LidarController::processMeasure) are rejected: they do not change the
+  output and are counted in rejected.
+*******************************************************************************/
+class LidarFilter {
+  static_assert((LIDAR_MEDIAN_SIZE & 1) and LIDAR_MEDIAN_SIZE <= 7,
+    "LIDAR_MEDIAN_SIZE has to be odd, at most 7");
+  public:
+/*******************************************************************************
+  begin : select the filter
+
+  a, b : FILTER_ALPHA_BETA, alpha and beta in Q8 (128 = 0.5)
+         FILTER_KALMAN, process noise Q and measurement noise R in cm²
+*******************************************************************************/
+    void begin(LIDAR_FILTER _type = FILTER_NONE, uint16_t a = 128, uint16_t b = 32, uint8_t _minStrength = 0){
+      type = _type;
+      gainA = a;
+      gainB = b;
+      minStrength = _minStrength;
+      reset();
+    };
+
+/*******************************************************************************
+  reset : forget the history, the next measure is taken as is
+*******************************************************************************/
+    void reset(){
+      count = 0;
+      index = 0;
+      speed = 0;
+      variance = 0;
+    };
+
+/*******************************************************************************
+  reject : count a rejected measure, returns the unchanged output
+*******************************************************************************/
+    int16_t reject(){
+      rejected++;
+      return output;
+    };
+
+/*******************************************************************************
+  update : filter a new measure
+
+  distance : the measure in cm
+  strength : its signal strength
+  time : micros() of the measure
+
+  returns the filtered distance
+*******************************************************************************/
+    int16_t update(int16_t distance, uint8_t strength, unsigned long time){
+      if(strength < minStrength)
+        return reject();
+      unsigned long dt = time - lastTime;
+      lastTime = time;
+      if(count == 0){
+        // First measure, nothing to filter yet
+        position = (int32_t) distance << 8;
+        variance = (int32_t) gainB << 8;
+        window[0] = distance;
+        index = 1;
+        count = 1;
+        output = distance;
+        return output;
+      }
+      if(count < 0xff)
+        count++;
+      switch(type){
+        case FILTER_MEDIAN:
+          output = median(distance);
+          break;
+        case FILTER_ALPHA_BETA:
+          output = alphaBeta(distance, dt);
+          break;
+        case FILTER_KALMAN:
+          output = kalman(distance, strength);
+          break;
+        default:
+          output = distance;
+          break;
+      }
+      return output;
+    };
+
+    LIDAR_FILTER type = FILTER_NONE;
+    uint8_t minStrength = 0;  // Measures under this strength are rejected
+    uint16_t rejected = 0;    // Rejected measures
+    int16_t output = -1;      // Last filtered distance
+    uint16_t gainA = 128;     // a and b of begin()
+    uint16_t gainB = 32;
+
+  private:
+    int16_t median(int16_t distance){
+      window[index] = distance;
+      index = index + 1 < LIDAR_MEDIAN_SIZE ? index + 1 : 0;
+      uint8_t n = count < LIDAR_MEDIAN_SIZE ? count : LIDAR_MEDIAN_SIZE;
+      // Insertion sort of at most 7 values
+      int16_t sorted[LIDAR_MEDIAN_SIZE];
+      for(uint8_t i = 0; i < n; i++){
+        int16_t value = window[i];
+        uint8_t j = i;
+        while(j > 0 and sorted[j - 1] > value){
+          sorted[j] = sorted[j - 1];
+          j--;
+        }
+        sorted[j] = value;
+      }
+      return sorted[n >> 1];
+    };
+
+    // position in Q8 cm, speed in Q8 cm/s
+    int16_t alphaBeta(int16_t distance, unsigned long dt){
+      uint16_t dtMs = dt / 1000;
+      if(dtMs == 0)
+        dtMs = 1;
+      else if(dtMs > LIDAR_FILTER_MAX_DT_MS)
+        dtMs = LIDAR_FILTER_MAX_DT_MS;
+      int32_t predicted = position + speed * dtMs / 1000;
+      int32_t residual = ((int32_t) distance << 8) - predicted;
+      position = predicted + ((residual * gainA) >> 8);
+      speed += ((residual * gainB) >> 8) * 1000 / dtMs;
+      return (position + 128) >> 8;
+    };
+
+    // position and variance in Q8, gainA = Q, gainB = R (cm²)
+    int16_t kalman(int16_t distance, uint8_t strength){
+      variance += (int32_t) gainA << 8;
+      // A weak return is a noisy measure
+      int32_t noise = ((int32_t) gainB << 8) * LIDAR_FILTER_STRENGTH_REF / (strength ? strength : 1);
+      // gain in Q8, variance is at most a few 1000 cm² so it does not overflow
+      int32_t gain = (variance << 8) / (variance + noise);
+      position += ((((int32_t) distance << 8) - position) * gain) >> 8;
+      variance = (variance * (256 - gain)) >> 8;
+      return (position + 128) >> 8;
+    };
+
+    int32_t position = 0;
+    int32_t speed = 0;
+    int32_t variance = 0;
+    unsigned long lastTime = 0;
+    int16_t window[LIDAR_MEDIAN_SIZE];
+    uint8_t index = 0;
+    uint8_t count = 0;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef LIDAR_FRAME_H
+#define LIDAR_FRAME_H
+
+#include <Arduino.h>
+#include "LidarObject.h"
+
+// Binary frame, all lasers of one cycle in one frame (see API_depth.md)
+#define LIDAR_FRAME_SYNC_1        0xAA
+#define LIDAR_FRAME_SYNC_2        0x55
+#define LIDAR_FRAME_VERSION       1
+// sync (2), version, board, sequence, count, timestamp (4)
+#define LIDAR_FRAME_HEADER        10
+// distance (2), strength, state, timestamp (4)
+#define LIDAR_FRAME_LASER         8
+// Maximum number of lasers in a frame, up to 30 (a merged frame, LidarLink.h)
+#ifndef LIDAR_FRAME_MAX_LASERS
+#define LIDAR_FRAME_MAX_LASERS    8
+#endif
+#define LIDAR_FRAME_SIZE          (LIDAR_FRAME_HEADER + LIDAR_FRAME_LASER * LIDAR_FRAME_MAX_LASERS + 2)
+
+/*******************************************************************************
+  LidarFrame : encoder of the binary frames, written without blocking
+
+  Frame (little endian):
+    0xAA 0x55 | version | board | sequence | count | timestamp (uint32, µs)
+    count x [ distance (int16, cm) | strength | state | timestamp (uint32, µs) ]
+    CRC-16/CCITT (0xFFFF, poly 0x1021) of everything after the sync bytes
+*******************************************************************************/
+class LidarFrame {
+  static_assert(LIDAR_FRAME_SIZE <= 255, "LIDAR_FRAME_MAX_LASERS is too big for one frame");
+  public:
+    LidarFrame(uint8_t _board = 0) : board(_board) {};
+
+/*******************************************************************************
+  start : start a new frame, timestamp is the time of the frame (µs)
+
+  returns false (and counts the drop) if the last frame is still being sent
+*******************************************************************************/
+    bool start(unsigned long timestamp){
+      if(busy()){
+        dropped++;
+        return false;
+      }
+      buffer[0] = LIDAR_FRAME_SYNC_1;
+      buffer[1] = LIDAR_FRAME_SYNC_2;
+      buffer[2] = LIDAR_FRAME_VERSION;
+      buffer[3] = board;
+      buffer[4] = sequence++;
+      buffer[5] = 0;
+      put32(6, timestamp);
+      length = LIDAR_FRAME_HEADER;
+      sent = 0;
+      return true;
+    };
+
+/*******************************************************************************
+  add : append one laser to the frame being built
+
+  returns false if the frame is full
+*******************************************************************************/
+    bool add(int16_t distance, uint8_t strength, uint8_t state, unsigned long timestamp){
+      if(buffer[5] >= LIDAR_FRAME_MAX_LASERS)
+        return false;
+      put16(length, distance);
+      buffer[length + 2] = strength;
+      buffer[length + 3] = state;
+      put32(length + 4, timestamp);
+      length += LIDAR_FRAME_LASER;
+      buffer[5]++;
+      return true;
+    };
+
+    bool add(LidarObject * lidar){
+      return add(lidar->distance, lidar->strength, lidar->lidar_state, lidar->sampleTime);
+    };
+
+/*******************************************************************************
+  finish : append the CRC, the frame is then ready to be written
+*******************************************************************************/
+    void finish(){
+      put16(length, crc16(buffer + 2, length - 2));
+      length += 2;
+    };
+
+/*******************************************************************************
+  encode : build the frame of every laser of the controller
+
+  returns false (and counts the drop) if the last frame is still being sent
+*******************************************************************************/
+    template <class Controller>
+    bool encode(Controller & controller){
+      if(!start(micros()))
+        return false;
+      for(uint8_t i = 0; i < controller.getCount(); i++)
+        add(controller.lidars[i]);
+      finish();
+      return true;
+    };
+
+/*******************************************************************************
+  write : write what the port can take without blocking (availableForWrite)
+
+  Call it on every loop. returns true once the whole frame is written
+*******************************************************************************/
+    template <class Port>
+    bool write(Port & port){
+      if(!busy())
+        return true;
+      int room = port.availableForWrite();
+      if(room <= 0)
+        return false;
+      uint8_t n = length - sent;
+      if(n > room)
+        n = room;
+      sent += port.write(buffer + sent, n);
+      return !busy();
+    };
+
+/*******************************************************************************
+  busy : returns true while the frame is not entirely written
+*******************************************************************************/
+    inline bool busy(){
+      return sent < length;
+    };
+
+/*******************************************************************************
+  crc16 : CRC-16/CCITT-FALSE of n bytes
+*******************************************************************************/
+    static uint16_t crc16(const uint8_t * data, uint16_t n, uint16_t crc = 0xffff){
+      while(n--){
+        crc ^= (uint16_t)(*data++) << 8;
+        for(uint8_t bit = 0; bit < 8; bit++)
+          crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+      }
+      return crc;
+    };
+
+    uint8_t buffer[LIDAR_FRAME_SIZE];
+    uint8_t length = 0;   // Length of the frame in buffer
+    uint8_t board;        // Board id, 0 for a single board
+    uint8_t sequence = 0; // Sequence number of the next frame
+    uint16_t dropped = 0; // Frames not started because the port was busy
+
+  private:
+    void put16(uint8_t index, uint16_t value){
+      buffer[index] = value & 0xff;
+      buffer[index + 1] = value >> 8;
+    };
+
+    void put32(uint8_t index, uint32_t value){
+      put16(index, value & 0xffff);
+      put16(index + 2, value >> 16);
+    };
+
+    uint8_t sent = 0;     // Bytes of the frame already written
+};
+
+/*******************************************************************************
+  LidarFrameReader : decoder of the binary frames, fed byte by byte
+
+  A frame with a bad version, too many lasers or a bad CRC is dropped and
+  counted in errors, the decoder then waits for the next sync bytes. The
+  fields of the last complete frame stay valid until the next byte is fed.
+*******************************************************************************/
+class LidarFrameReader {
+  public:
+/*******************************************************************************
+  read : feed the bytes available on the port, stops after a complete frame
+
+  returns true if a frame is complete
+*******************************************************************************/
+    template <class Port>
+    bool read(Port & port){
+      while(port.available() > 0){
+        if(push(port.read()))
+          return true;
+      }
+      return false;
+    };
+
+/*******************************************************************************
+  push : feed one byte
+
+  returns true if it completes a frame
+*******************************************************************************/
+    bool push(uint8_t byte){
+      if(length == 0 and byte != LIDAR_FRAME_SYNC_1)
+        return false;
+      if(length == 1 and byte != LIDAR_FRAME_SYNC_2){
+        length = byte == LIDAR_FRAME_SYNC_1 ? 1 : 0;
+        return false;
+      }
+      buffer[length++] = byte;
+      if(length < LIDAR_FRAME_HEADER)
+        return false;
+      if(buffer[2] != LIDAR_FRAME_VERSION or buffer[5] > LIDAR_FRAME_MAX_LASERS){
+        errors++;
+        length = 0;
+        return false;
+      }
+      uint8_t size = LIDAR_FRAME_HEADER + LIDAR_FRAME_LASER * buffer[5] + 2;
+      if(length < size)
+        return false;
+      length = 0;
+      if(LidarFrame::crc16(buffer + 2, size - 4) != get16(size - 2)){
+        errors++;
+        return false;
+      }
+      return true;
+    };
+
+/*******************************************************************************
+  Fields of the last complete frame, i is the laser in the frame
+*******************************************************************************/
+    inline uint8_t board(){ return buffer[3]; };
+    inline uint8_t sequence(){ return buffer[4]; };
+    inline uint8_t count(){ return buffer[5]; };
+    inline unsigned long timestamp(){ return get32(6); };
+    inline int16_t distance(uint8_t i){ return get16(laser(i)); };
+    inline uint8_t strength(uint8_t i){ return buffer[laser(i) + 2]; };
+    inline uint8_t state(uint8_t i){ return buffer[laser(i) + 3]; };
+    inline unsigned long time(uint8_t i){ return get32(laser(i) + 4); };
+
+    uint16_t errors = 0;  // Frames dropped (version, count or CRC)
+
+  private:
+    inline uint8_t laser(uint8_t i){
+      return LIDAR_FRAME_HEADER + LIDAR_FRAME_LASER * i;
+    };
+
+    uint16_t get16(uint8_t index){
+      return buffer[index] | (uint16_t) buffer[index + 1] << 8;
+    };
+
+    uint32_t get32(uint8_t index){
+      return get16(index) | (uint32_t) get16(index + 2) << 16;
+    };
+
+    uint8_t buffer[LIDAR_FRAME_SIZE];
+    uint8_t length = 0;   // Bytes of the frame being read
+};
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef LIDAR_LINK_H
+#define LIDAR_LINK_H
+
+#include <Arduino.h>
+#include "LidarFrame.h"
+
+// Board id of the coordinator, the nodes are 1 to NODES
+#define LIDAR_LINK_COORDINATOR    0
+// High pulse on the sync line (µs)
+#define LIDAR_LINK_PULSE_US       10
+// State of the lasers of a node missing from a merged frame
+#define LIDAR_LINK_MISSING        0xff
+
+/*******************************************************************************
+  LidarLink : several boards, one host link
+
+  One board, the coordinator, drives a sync line wired to every node (a GPIO
+  with an interrupt on the nodes) and a serial link to each of them (its TX
+  can drive the RX of all the nodes, each node TX goes to an RX of its own).
+  On every period the coordinator:
+    - pulses the sync line, the synchronized group of every board is
+      triggered (LidarController::setExternalTrigger, requestFrame)
+    - broadcasts a time frame: a LidarFrame without laser, its timestamp is
+      the micros() of the coordinator at the pulse
+  Each node timestamps the pulse with its own micros(), so the time frame
+  gives the offset between the two clocks: the node sends its frame in the
+  time of the coordinator, with the sequence of the pulse. The coordinator
+  merges its own group and the frames of the nodes into one LidarFrame for
+  the host, in a fixed order (its lasers, then node 1, node 2...). A node
+  late for the next pulse leaves its lasers LIDAR_LINK_MISSING.
+
+  The boards trigger within a spinOnce() of each other, the timestamps are
+  exact (the trigger time of each board, in the time of the coordinator).
+*******************************************************************************/
+
+/*******************************************************************************
+  LidarLinkNode : a board driven by the coordinator
+*******************************************************************************/
+class LidarLinkNode {
+  public:
+    LidarLinkNode(uint8_t board) : frame(board) {};
+
+/*******************************************************************************
+  begin : syncPin is the sync line, call syncEdge() on its rising edges (an
+  interrupt). The synchronized group only triggers on the pulses
+*******************************************************************************/
+    template <class Controller>
+    void begin(Controller & controller, uint8_t syncPin){
+      pinMode(syncPin, INPUT);
+      controller.setExternalTrigger(true);
+    };
+
+/*******************************************************************************
+  syncEdge : rising edge of the sync line, ISR safe
+*******************************************************************************/
+    inline void syncEdge(){
+      edgeTime = micros();
+      edgePending = true;
+    };
+
+/*******************************************************************************
+  spin : call it on every loop, after spinOnce(). Triggers the group on a
+  pulse, reads the time frames and writes the frames of the group to the
+  coordinator without blocking
+*******************************************************************************/
+    template <class Controller, class Port>
+    void spin(Controller & controller, Port & port){
+      if(edgePending){
+        noInterrupts();
+        lastEdge = edgeTime;
+        edgePending = false;
+        interrupts();
+        timed = false;
+        controller.requestFrame();
+      }
+      while(reader.read(port)){
+        if(reader.board() != LIDAR_LINK_COORDINATOR or reader.count() != 0)
+          continue;
+        offset = reader.timestamp() - lastEdge;
+        sequence = reader.sequence();
+        timed = true;
+      }
+      if(controller.syncFrame())
+        ready = true;
+      // The frame waits for the time frame of the pulse that triggered it
+      if(ready and timed and !frame.busy()){
+        ready = false;
+        encode(controller);
+      }
+      frame.write(port);
+    };
+
+/*******************************************************************************
+  toCoordinator : a micros() of this board in the time of the coordinator
+*******************************************************************************/
+    inline unsigned long toCoordinator(unsigned long time){
+      return time + offset;
+    };
+
+    LidarFrame frame;           // Frames sent to the coordinator
+    LidarFrameReader reader;    // Time frames of the coordinator
+    unsigned long offset = 0;   // Coordinator micros() - node micros()
+
+  private:
+    template <class Controller>
+    void encode(Controller & controller){
+      unsigned long time = controller.frameTime();
+      // Triggered before the last pulse: the frame of the previous one
+      frame.sequence = (long) (time - lastEdge) >= 0 ? sequence : sequence - 1;
+      frame.start(toCoordinator(time));
+      for(uint8_t i = 0; i < controller.getCount(); i++)
+        frame.add(controller.frameDistances()[i], controller.frameStrengths()[i],
+          controller.frameStates()[i], toCoordinator(time));
+      frame.finish();
+    };
+
+    volatile unsigned long edgeTime = 0;
+    volatile bool edgePending = false;
+    unsigned long lastEdge = 0;
+    uint8_t sequence = 0;       // Sequence of the last time frame
+    bool timed = false;         // The time frame of the last pulse is received
+    bool ready = false;         // A frame of the group waits to be sent
+};
+
+/*******************************************************************************
+  LidarLinkSample : one laser of a merged frame
+*******************************************************************************/
+struct LidarLinkSample {
+  int16_t distance;
+  uint8_t strength;
+  uint8_t state;
+  unsigned long time;
+};
+
+/*******************************************************************************
+  LidarLinkCoordinator : the board driving NODES nodes and writing the merged
+  frames to the host. The merged frame has up to LIDAR_FRAME_MAX_LASERS
+  lasers, define it (up to 30) before including the library
+*******************************************************************************/
+template <uint8_t NODES>
+class LidarLinkCoordinator {
+  static_assert(NODES > 0 and NODES < 16, "LidarLinkCoordinator handles 1 to 15 nodes");
+  public:
+    LidarLinkCoordinator() : frame(LIDAR_LINK_COORDINATOR), merged(LIDAR_LINK_COORDINATOR) {};
+
+/*******************************************************************************
+  begin : syncPin is the sync line, period the µs between two frames (longer
+  than an acquisition plus the transfer of a node frame), lasers the number
+  of lasers of the coordinator in the merged frame
+*******************************************************************************/
+    template <class Controller>
+    void begin(Controller & controller, uint8_t _syncPin, unsigned long _period, uint8_t lasers){
+      syncPin = _syncPin;
+      period = _period;
+      pinMode(syncPin, OUTPUT);
+      digitalWrite(syncPin, LOW);
+      controller.setExternalTrigger(true);
+      own = min(lasers, LIDAR_FRAME_MAX_LASERS);
+      slotCount = own;
+      tickTime = micros() - period;
+    };
+
+/*******************************************************************************
+  addNode : the next node (board id 1, 2...), its frames are read from port,
+  its lasers take the next slots of the merged frame
+
+  returns its board id, 0 if there is no room left
+*******************************************************************************/
+    uint8_t addNode(Stream & port, uint8_t lasers){
+      if(nodeCount >= NODES or slotCount + lasers > LIDAR_FRAME_MAX_LASERS)
+        return 0;
+      ports[nodeCount] = &port;
+      first[nodeCount] = slotCount;
+      size[nodeCount] = lasers;
+      slotCount += lasers;
+      return ++nodeCount;
+    };
+
+/*******************************************************************************
+  spin : call it on every loop, after spinOnce(). downlink is the port
+  broadcasting the time frames to the nodes, host the port of the merged
+  frames, both written without blocking
+*******************************************************************************/
+    template <class Controller, class Downlink, class Host>
+    void spin(Controller & controller, Downlink & downlink, Host & host){
+      if(micros() - tickTime >= period)
+        tick(controller);
+      frame.write(downlink);
+      for(uint8_t n = 0; n < nodeCount; n++){
+        while(readers[n].read(*ports[n]))
+          collect(n);
+      }
+      if(controller.syncFrame())
+        collect(controller);
+      if(!emitted and received == complete())
+        emit();
+      merged.write(host);
+    };
+
+    LidarFrame frame;           // Time frames sent to the nodes
+    LidarFrame merged;          // Merged frames sent to the host
+    LidarFrameReader readers[NODES];
+    uint16_t late = 0;          // Frames received after the next pulse
+    uint16_t missing[NODES] = {0}; // Merged frames without the node
+
+  private:
+    template <class Controller>
+    void tick(Controller & controller){
+      if(!emitted)
+        emit();
+      digitalWrite(syncPin, HIGH);
+      tickTime = micros();
+      delayMicroseconds(LIDAR_LINK_PULSE_US);
+      digitalWrite(syncPin, LOW);
+      controller.requestFrame();
+      sequence++;
+      received = 0;
+      emitted = false;
+      for(uint8_t s = 0; s < slotCount; s++){
+        slots[s].distance = 0;
+        slots[s].strength = 0;
+        slots[s].state = LIDAR_LINK_MISSING;
+        slots[s].time = tickTime;
+      }
+      // Skipped (counted in frame.dropped) if the last one is not written yet
+      frame.sequence = sequence;
+      if(frame.start(tickTime))
+        frame.finish();
+    };
+
+    // Frame of the node n
+    void collect(uint8_t n){
+      LidarFrameReader & reader = readers[n];
+      if(reader.sequence() != sequence or emitted){
+        late++;
+        return;
+      }
+      for(uint8_t i = 0; i < reader.count() and i < size[n]; i++){
+        LidarLinkSample & slot = slots[first[n] + i];
+        slot.distance = reader.distance(i);
+        slot.strength = reader.strength(i);
+        slot.state = reader.state(i);
+        slot.time = reader.time(i);
+      }
+      received |= (uint16_t) (1U << (n + 1));
+    };
+
+    // Frame of the group of the coordinator, triggered by the last pulse
+    template <class Controller>
+    void collect(Controller & controller){
+      unsigned long time = controller.frameTime();
+      if((long) (time - tickTime) < 0 or emitted){
+        late++;
+        return;
+      }
+      for(uint8_t i = 0; i < own and i < controller.getCount(); i++){
+        slots[i].distance = controller.frameDistances()[i];
+        slots[i].strength = controller.frameStrengths()[i];
+        slots[i].state = controller.frameStates()[i];
+        slots[i].time = time;
+      }
+      received |= 1;
+    };
+
+    void emit(){
+      emitted = true;
+      for(uint8_t n = 0; n < nodeCount; n++){
+        if(!(received & (1U << (n + 1))))
+          missing[n]++;
+      }
+      merged.sequence = sequence;
+      if(!merged.start(tickTime))
+        return;
+      for(uint8_t s = 0; s < slotCount; s++)
+        merged.add(slots[s].distance, slots[s].strength, slots[s].state, slots[s].time);
+      merged.finish();
+    };
+
+    inline uint16_t complete(){
+      // 32 bits: 1 << 16 does not fit an int on AVR for 15 nodes
+      return (uint16_t) ((1UL << (nodeCount + 1)) - 1);
+    };
+
+    Stream * ports[NODES];
+    uint8_t first[NODES];       // First slot and number of lasers of each node
+    uint8_t size[NODES];
+    uint8_t own = 0;            // Lasers of the coordinator, the first slots
+    uint8_t nodeCount = 0;
+    uint8_t slotCount = 0;
+    LidarLinkSample slots[LIDAR_FRAME_MAX_LASERS];
+    uint8_t syncPin = 0;
+    unsigned long period = 0;
+    unsigned long tickTime = 0;
+    uint8_t sequence = 0;
+    uint16_t received = 0;      // Bit 0 for the coordinator, n for the node n
+    bool emitted = true;        // The merged frame of the last pulse is done
+};
+
+#endif
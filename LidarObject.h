@@ -1,19 +1,103 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include "I2CFunctions.h"
+#include "LidarBuffer.h"
+#include "LidarFilter.h"
 // We got a Lidar object per laser. 
 
 #ifndef LIDAR_OBJECT_H
 #define LIDAR_OBJECT_H
 
-#define LIDAR_RESET_US            20000
+#define LIDAR_RESET_US            20000UL
+// Pulse width of the PWM output (mode pin) per cm
+#define PWM_US_PER_CM             10
+// Defaults of the limits of each laser, see LidarObject::setLimits
+// No measure for LIDAR_TIMEOUT_US recovers the laser
 #define LIDAR_TIMEOUT_US          200000
+// Force reset on errors. It resets the lasers on MAX_NACKS error.
+// An error is a misreading (nack) or an incoherent value
+#define MAX_NACKS                 25
+#define ERROR_MAX_VALUE           1000
+#define ERROR_MIN_VALUE           4
+// Difference of measure between two measurements
+#define ERROR_MAX_DIFF_VALUE      100
+// Error score of an error, a good measure takes 1 off: a laser resets on
+// MAX_NACKS errors in a row, or on more than 1 error in 5 measures
+#define LIDAR_ERROR_WEIGHT        4
+
+// Keep the last measures of each laser in a ring (LidarObject::samples)
+#ifndef ENABLE_SAMPLE_BUFFER
+#define ENABLE_SAMPLE_BUFFER      false
+#endif
+// Size of the ring, power of 2 up to 128, costs 8 bytes per sample per laser
+#ifndef LIDAR_BUFFER_SIZE
+#define LIDAR_BUFFER_SIZE         8
+#endif
 
 enum LIDAR_STATE {
   SHUTING_DOWN = 240,       // Shutdown the laser to reset it
   NEED_RESET = 48,          // Too much outliers, need to reset
   RESET_PENDING = 80,       // Wait 15ms after you reset the Lidar, we are waiting in this state
   ACQUISITION_IN_PROGRESS = 64, // The acquisition in on progress
+  WAITING_TRIGGER = 16,     // Measure read, waiting for the scheduler (or the synchronized group) to trigger the next one
+  PARKED = 96,              // Receiver off or asleep (REG_POWER_CONTROL), addressed, waiting for wake()
+};
+
+// Number of LIDAR_STATE, see lidarStateIndex
+#define LIDAR_STATE_COUNT         6
+
+/*******************************************************************************
+  lidarStateIndex : index (0 to LIDAR_STATE_COUNT - 1) of a state, for tables
+*******************************************************************************/
+inline uint8_t lidarStateIndex(LIDAR_STATE state){
+  switch(state){
+    case SHUTING_DOWN: return 0;
+    case NEED_RESET: return 1;
+    case RESET_PENDING: return 2;
+    case WAITING_TRIGGER: return 4;
+    case PARKED: return 5;
+    default: return 3; // ACQUISITION_IN_PROGRESS
+  }
+}
+
+// Health of the last measure (LidarObject::health), from REG_STATUS and the
+// limits of the laser
+enum LIDAR_HEALTH {
+  HEALTH_OK = 0,
+  HEALTH_NO_SIGNAL = 1,           // No peak detected (status bit 3), nothing in range
+  HEALTH_SIGNAL_OVERFLOW = 2,     // Strong return saturating the correlation (status bit 2)
+  HEALTH_REFERENCE_OVERFLOW = 4,  // Reference saturated (status bit 1)
+  HEALTH_FAULT = 8,               // Health flag cleared (status bit 5), reference or receiver bias
+  HEALTH_PROCESS_ERROR = 16,      // Process error flag (status bit 6)
+  HEALTH_OUT_OF_RANGE = 32,       // Distance outside [minDistance, maxDistance]
+  HEALTH_JUMP = 64                // More than maxJump from the previous valid distance
+};
+// Flags counted as errors (error score, reset)
+#define HEALTH_ERRORS             (HEALTH_PROCESS_ERROR | HEALTH_OUT_OF_RANGE | HEALTH_JUMP)
+
+/*******************************************************************************
+  lidarHealth : health flags of a REG_STATUS value
+*******************************************************************************/
+inline uint8_t lidarHealth(uint8_t status){
+  uint8_t health = HEALTH_OK;
+  if(bitRead(status, 3))
+    health |= HEALTH_NO_SIGNAL;
+  if(bitRead(status, 2))
+    health |= HEALTH_SIGNAL_OVERFLOW;
+  if(bitRead(status, 1))
+    health |= HEALTH_REFERENCE_OVERFLOW;
+  if(!bitRead(status, 5))
+    health |= HEALTH_FAULT;
+  if(bitRead(status, 6))
+    health |= HEALTH_PROCESS_ERROR;
+  return health;
+}
+
+enum LIDAR_RECOVERY {
+  RECOVERY_RETRY = 0,       // Start a new acquisition
+  RECOVERY_RECONFIGURE = 1, // Write the configuration again
+  RECOVERY_SOFT_RESET = 2,  // Reset the registers and address it by serial
+  RECOVERY_POWER_CYCLE = 3  // Power cycle the laser
 };
 
 enum LIDAR_MODE {
@@ -23,6 +107,29 @@ enum LIDAR_MODE {
   DISTANCE_AND_VELOCITY = 3
 };
 
+enum LIDAR_VERSION {
+  VERSION_UNKNOWN = 0,      // Not detected yet, or the detection failed
+  LIDAR_LITE_V2 = 2,
+  LIDAR_LITE_V3 = 3,
+  LIDAR_LITE_V3HP = 4       // Not detected (seen as v3), see setVersion
+};
+
+// Capabilities and workarounds of a laser (LidarObject::capabilities)
+// The offset register has to be reset after each measure (I2C problems of the v2)
+#define CAPABILITY_RESET_OFFSET   0x01
+
+/*******************************************************************************
+  versionCapabilities : capabilities of a version, unknown lasers keep every
+  workaround
+*******************************************************************************/
+inline uint8_t versionCapabilities(LIDAR_VERSION version){
+  switch(version){
+    case LIDAR_LITE_V3: return 0;
+    case LIDAR_LITE_V3HP: return 0;
+    default: return CAPABILITY_RESET_OFFSET; // LIDAR_LITE_V2, VERSION_UNKNOWN
+  }
+}
+
 enum LIDAR_TYPE {
   I2C_TYPE = 0,
   CONTINUOUS_I2C_TYPE = 1,
@@ -41,9 +148,11 @@ class LidarObject {
   If fasti2c is true, use 400kHz I2C
 *******************************************************************************/
     void begin(uint8_t _EnablePin = 12, uint8_t _ModePin = 13, uint8_t _TrigPin = 11, uint8_t _Lidar = 0x62, uint8_t _configuration = 2,  LIDAR_MODE _mode = DISTANCE, char _name = 'A'){
+      // Kept powered (high before the pin is an output), a Lidar that kept its
+      // address is not power cycled on a warm restart (LidarController::add)
+      digitalWrite(_EnablePin, HIGH);
       pinMode(_EnablePin, OUTPUT);
     
-      off();
       last_distance = 0;
       distance = 0;
       velocity = 0;
@@ -73,14 +182,96 @@ class LidarObject {
     };
 
 /*******************************************************************************
-  beginPWM : Sets the pinMode of the trigger and the mode pin. It allows PWM 
-  readings but ... it makes I2C reading slower on v2. (not tested on v3).
+  beginPWM : Read the laser from the pulse width on its mode pin (PWM_TYPE),
+  PWM_US_PER_CM, instead of I2C. The trigger pin pulls the mode pin low
+  through a 1k resistor, the laser then measures continuously. Call
+  pwmEdge() on each edge of the mode pin, from a CHANGE interrupt:
+
+    void pwmZ1() { LZ1.pwmEdge(); }
+    attachInterrupt(digitalPinToInterrupt(Z1_LASER_PIN), pwmZ1, CHANGE);
+
+  attachInterrupt() only works on the external interrupt pins (2 and 3 on
+  the Uno, digitalPinToInterrupt() returns NOT_AN_INTERRUPT on the others):
+  wire the mode pins there, or call pwmEdge() from a pin change interrupt.
+  I2C is only used to address, configure and recover the laser. The pulses
+  of all the lasers are measured in parallel. On v2, the PWM output makes
+  the I2C reading slower, it is not needed anymore.
 *******************************************************************************/
     void beginPWM(){
       pinMode(ModePin, INPUT);
       pinMode(TrigPin, OUTPUT);
+      disable();
+      type = PWM_TYPE;
+      statusPin = false;
     };
 
+/*******************************************************************************
+  pwmEdge : Edge of the mode pin of a PWM_TYPE laser, interrupt safe. The
+  falling edge ends a pulse, read by pwmRead()
+*******************************************************************************/
+    void pwmEdge(){
+      unsigned long now = micros();
+      if(digitalRead(ModePin) == HIGH){
+        pwmRise = now;
+        pwmHigh = true;
+      } else if(pwmHigh){
+        pwmHigh = false;
+        pwmWidth = now - pwmRise;
+        pwmTime = pwmRise;
+        pwmReady = true;
+      }
+    };
+
+/*******************************************************************************
+  pwmRead : Newest pulse of a PWM_TYPE laser, once
+
+  distance : the distance in cm, time : micros() of the rising edge
+  returns false if there is no new pulse
+*******************************************************************************/
+    bool pwmRead(int16_t * _distance, unsigned long * time){
+      if(!pwmReady)
+        return false;
+      noInterrupts();
+      unsigned long width = pwmWidth;
+      *time = pwmTime;
+      pwmReady = false;
+      interrupts();
+      *_distance = width / PWM_US_PER_CM;
+      return true;
+    };
+
+/*******************************************************************************
+  isPWM : The laser is read from its PWM output (beginPWM)
+*******************************************************************************/
+    inline bool isPWM(){
+      return type == PWM_TYPE;
+    };
+
+/*******************************************************************************
+  hasStatus : The status register is read before each measure (neither the
+  status pin nor the PWM output is used)
+*******************************************************************************/
+    inline bool hasStatus(){
+      return !statusPin and type != PWM_TYPE;
+    };
+
+
+/*******************************************************************************
+  beginStatusPin : Use the mode pin as busy flag (status output mode) instead of
+  polling the status register over I2C. The controller configures the mode
+  pin on the next configure(), reset the laser if it is already running.
+*******************************************************************************/
+    void beginStatusPin(){
+      pinMode(ModePin, INPUT);
+      statusPin = true;
+    };
+
+/*******************************************************************************
+  isBusyPin : In status output mode, the mode pin is high while busy
+*******************************************************************************/
+    inline bool isBusyPin(){
+      return digitalRead(ModePin) == HIGH;
+    };
 
 /*******************************************************************************
   enable : ask for PWM reading and allow continuous readings
@@ -106,9 +297,11 @@ class LidarObject {
 /*******************************************************************************
   checkTimer : Check the reset timer to see if the laser is correctly resetted
 
-  The laser takes 20ms to reset
+  The laser takes 20ms to reset, a laser in SHUTING_DOWN stays off during holdOff
 *******************************************************************************/
     bool checkTimer(){
+      if(lidar_state == SHUTING_DOWN)
+        return (micros() - timeReset >= holdOff);
       if(lidar_state != RESET_PENDING)
         return true;
 
@@ -119,15 +312,66 @@ class LidarObject {
   checkLastMeasure : If the laser do not give new data, simply reset it
 *******************************************************************************/
     bool checkLastMeasure(){
-      return (micros() - lastMeasureTime > LIDAR_TIMEOUT_US);
+      return (micros() - lastMeasureTime > timeout);
+    };
+
+/*******************************************************************************
+  isFreeRunning : A CONTINUOUS_I2C_TYPE laser or a laser measuring the velocity
+  measures continuously every measurePeriod(), it is never triggered again
+*******************************************************************************/
+    inline bool isFreeRunning(){
+      return type == CONTINUOUS_I2C_TYPE or (mode & VELOCITY);
+    };
+
+/*******************************************************************************
+  checkMeasurePeriod : A free running laser (isFreeRunning) produces a measure 
+  every measurePeriod(), there is no need to read it more often
+*******************************************************************************/
+    bool checkMeasurePeriod(){
+      if(!isFreeRunning())
+        return true;
+      return (long) (micros() - nextRead) >= 0;
+    };
+
+/*******************************************************************************
+  measureRead : A free running measure is being read, the next one is due one
+  measurePeriod() after this one was due, not after the read (the read and
+  loop latency would add up every period). Restarts from now if late by more
+  than a period (reset, long spin)
+*******************************************************************************/
+    void measureRead(){
+      unsigned long now = micros();
+      nextRead += measurePeriod();
+      if((long) (now - nextRead) >= 0)
+        nextRead = now + measurePeriod();
+    };
+
+/*******************************************************************************
+  measurePeriod : Period of the free running measures in µs, from measureDelay
+
+  0x14 (default) = 100Hz, 0xc8 = 10Hz
+*******************************************************************************/
+    unsigned long measurePeriod(){
+      return (unsigned long)(measureDelay) * 500UL;
     };
 
 /*******************************************************************************
-  resetNacksCount : The nack counter makes the Arduino able to know if a laser 
+  velocityScale : m/s of one count of REG_VELOCITY, the distance change in cm
+  between two measures separated by measurePeriod()
+
+  0xc8 (10Hz) = 0.1 m/s, 0x14 (100Hz) = 1 m/s
+*******************************************************************************/
+    float velocityScale(){
+      return 20.0 / measureDelay;
+    };
+
+/*******************************************************************************
+  resetNacksCount : The error score makes the Arduino able to know if a laser 
   needs to be resetted
 *******************************************************************************/
     bool resetNacksCount(){
       nacksCount = 0;
+      return true;
     };
 
 /*******************************************************************************
@@ -158,34 +402,165 @@ class LidarObject {
       if(notify_velocity_cb) notify_velocity_cb(this, dt);
     };
 
+/*******************************************************************************
+  setSerial : set the serial number (REG_UNIT_ID) of the laser. Lasers with a
+    known serial are powered and addressed at the same time on reset. The 
+    serial is learnt on the first (sequential) reset, store it to skip the
+    sequential reset on the next boot.
+*******************************************************************************/
+    void setSerial(uint16_t _serial){
+      serial = _serial;
+      hasSerial = true;
+    };
+
+/*******************************************************************************
+  setBiasPeriod : bias correct one acquisition every period acquisitions. The
+    bias correction slows the acquisition, the datasheet advises it once every
+    100 measures. 1 (default) corrects every measure, 0 never (except the first
+    one after a reset).
+*******************************************************************************/
+    void setBiasPeriod(uint8_t period = 100){
+      biasPeriod = period;
+      biasCount = 0;
+    };
+
+/*******************************************************************************
+  setLimits : coherent distances of this laser (cm), the others are errors
+    (HEALTH_OUT_OF_RANGE, HEALTH_JUMP). ERROR_MIN_VALUE, ERROR_MAX_VALUE and
+    ERROR_MAX_DIFF_VALUE by default, raise maxDistance for a long range laser.
+*******************************************************************************/
+    void setLimits(int16_t _minDistance, int16_t _maxDistance, int16_t _maxJump = ERROR_MAX_DIFF_VALUE){
+      minDistance = _minDistance;
+      maxDistance = _maxDistance;
+      maxJump = _maxJump;
+    };
+
+/*******************************************************************************
+  setErrorLimit : errors in a row (MAX_NACKS by default) and time without
+    measure in µs (LIDAR_TIMEOUT_US by default) before the laser is recovered
+*******************************************************************************/
+    void setErrorLimit(uint8_t _maxErrors, unsigned long _timeout = LIDAR_TIMEOUT_US){
+      maxErrors = _maxErrors;
+      timeout = _timeout;
+    };
+
+/*******************************************************************************
+  setOffset : distance offset in cm (REG_OFFSET_REGISTER), the measured bias
+    of this laser. Written on each configure(), 0 by default.
+*******************************************************************************/
+    void setOffset(int8_t _offset){
+      offset = _offset;
+    };
+
+/*******************************************************************************
+  setPowerSave : turn the receiver off (REG_POWER_CONTROL) while the laser
+    waits for its trigger (scheduled or synchronized lasers, WAITING_TRIGGER)
+    and back on right before the trigger. Saves the receiver current between
+    two samples, for two more writes per sample.
+*******************************************************************************/
+    void setPowerSave(bool enabled = true){
+      powerSave = enabled;
+    };
+
+/*******************************************************************************
+  setVersion : set the hardware version instead of detecting it on reset, with
+    the capabilities of this version
+*******************************************************************************/
+    void setVersion(LIDAR_VERSION _version){
+      version = _version;
+      versionSet = true;
+      capabilities = versionCapabilities(_version);
+    };
+
+/*******************************************************************************
+  setBus : set the I2C bus of the laser (the global I2C, on Wire, by default).
+    Has to be set before being added to the controller.
+*******************************************************************************/
+    void setBus(I2CFunctions & _bus){
+      bus = &_bus;
+    };
+
 /*******************************************************************************
   change_type : change the acqusition type, has to be changed before being added
     to the controller. Otherwise, reset it.
+
+  _measureDelay : REG_MEASURE_DELAY of the CONTINUOUS_I2C_TYPE (free running), 
+    0x14 (default) = 100Hz, 0xc8 = 10Hz, 0 is raised to 1
 *******************************************************************************/
-    void change_type(LIDAR_TYPE _type = I2C_TYPE){
+    void change_type(LIDAR_TYPE _type = I2C_TYPE, uint8_t _measureDelay = 0x14){
       type = _type;
+      measureDelay = _measureDelay ? _measureDelay : 1;
     };
 
     int16_t last_distance = -1; // Last distance measured
     int16_t distance = -1;      // Newest distance
-    float velocity = 0;       // Newest velocity
+#if ENABLE_FILTER
+    int16_t filtered_distance = -1; // Newest distance through filter
+    LidarFilter filter;         // FILTER_NONE by default, see LidarFilter::begin
+#endif
+    float velocity = 0;       // Newest velocity in m/s (mode VELOCITY)
     uint8_t strength = 0;   // Newest signal strength
+    uint8_t status = 0;     // Newest status register
+    // PWM_TYPE, pulse being measured and the newest one, see pwmEdge
+    volatile bool pwmHigh = false;
+    volatile bool pwmReady = false;
+    volatile unsigned long pwmRise = 0;
+    volatile unsigned long pwmWidth = 0;
+    volatile unsigned long pwmTime = 0;
 
-    uint8_t nacksCount = 0;
+    uint16_t nacksCount = 0;    // Error score, see LidarController::shouldIncrementNack
+    uint8_t health = HEALTH_OK; // LIDAR_HEALTH flags of the newest measure
+    // Limits, see setLimits and setErrorLimit
+    int16_t minDistance = ERROR_MIN_VALUE;
+    int16_t maxDistance = ERROR_MAX_VALUE;
+    int16_t maxJump = ERROR_MAX_DIFF_VALUE;
+    uint8_t maxErrors = MAX_NACKS;
+    unsigned long timeout = LIDAR_TIMEOUT_US;
+    bool queued = false;        // A queued I2C transaction chain is pending
+    bool statusPin = false;     // The mode pin is used as busy flag
     unsigned long timeReset = 0;
+    unsigned long triggerTime = 0;  // micros() of the last trigger (async)
+    unsigned long sampleTime = 0;   // Trigger time of the newest measure
+    unsigned long velocityTime = 0; // micros() of the newest velocity
+    unsigned long holdOff = 0;     // Power off time in SHUTING_DOWN
+    unsigned long recoveryTime = 0; // micros() of the last recovery
+    uint8_t recoveryLevel = RECOVERY_RETRY;
+    uint8_t powerCycles = 0;       // Consecutive power cycles, for the backoff
     uint8_t configuration;
+    int8_t offset = 0;          // REG_OFFSET_REGISTER, see setOffset
+    uint8_t measureDelay = 0x14; // REG_MEASURE_DELAY in free running and velocity mode
+    LIDAR_VERSION version = VERSION_UNKNOWN; // Detected on reset, unless versionSet
+    bool versionSet = false;    // The version is given by setVersion()
+    uint8_t capabilities = CAPABILITY_RESET_OFFSET; // CAPABILITY_* of the version
+    uint8_t biasPeriod = 1;     // Acquisitions per bias corrected acquisition
+    uint8_t biasCount = 0;      // Acquisitions since the last bias correction
+    bool powerSave = false;     // Receiver off in WAITING_TRIGGER, see setPowerSave
+    bool sleeping = false;      // PARKED in device sleep, configured again on wake
+    // ADAPTIVE_CONFIGURATION, level and sums of the current window
+    uint8_t adaptiveLevel = 2;
+    uint8_t adaptiveCount = 0;
+    uint8_t adaptiveFailures = 0;
+    uint16_t adaptiveStrength = 0;
+    uint32_t adaptiveDistance = 0;
     uint8_t address;
+    I2CFunctions * bus = &I2C;  // I2C bus of the laser
+    uint16_t serial = 0;        // Serial number (REG_UNIT_ID), if hasSerial
+    bool hasSerial = false;
     uint8_t EnablePin;
     uint8_t ModePin;
     uint8_t TrigPin;
     
     long lastMeasureTime = 0;
+    unsigned long nextRead = 0;     // Next free running measure, see measureRead
     char name;
     LIDAR_STATE lidar_state = NEED_RESET;
     LIDAR_MODE mode = DISTANCE;
     LIDAR_TYPE type = I2C_TYPE;
-    void (*notify_distance_cb)(LidarObject * self);
-    void (*notify_velocity_cb)(LidarObject * self, unsigned long dt);
+#if ENABLE_SAMPLE_BUFFER
+    LidarBuffer<LIDAR_BUFFER_SIZE> samples; // Measures not yet consumed
+#endif
+    void (*notify_distance_cb)(LidarObject * self) = NULL;
+    void (*notify_velocity_cb)(LidarObject * self, unsigned long dt) = NULL;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef LIDAR_SINK_H
+#define LIDAR_SINK_H
+
+#include <Arduino.h>
+#include "LidarObject.h"
+
+/*******************************************************************************
+  LidarCycle : the results of all the lasers at the end of a cycle (a
+  spinOnce() with new measures, or a frame of the synchronized group)
+
+  The arrays are indexed by laser id (count used), they stay valid until the
+  next spinOnce().
+*******************************************************************************/
+struct LidarCycle {
+  const int16_t * distances;
+  const uint8_t * strengths;
+  const uint8_t * states;   // LIDAR_STATE
+  uint32_t updated;         // Bit i is set if the laser i has a new measure
+  uint8_t count;            // Number of lasers (LidarController::getCount())
+  unsigned long time;       // micros() of the cycle, the trigger of a synchronized frame
+};
+
+/*******************************************************************************
+  LidarSink : compile time destination of the results, the second template
+  parameter of LidarControllerN
+
+  The controller calls Sink::measure() for each new distance, Sink::velocity()
+  for each new velocity and Sink::frame() once per cycle. They are static and
+  known at compile time, so they are inlined: no indirect call and no null
+  check per sample. Derive from LidarSink and hide only the hooks you need:
+
+    struct PrintSink : LidarSink {
+      static inline void frame(const LidarCycle & cycle) { ... }
+    };
+    static LidarControllerN<4, PrintSink> Controller;
+
+  Keep them short, they run inside spinOnce(), between two bus transactions.
+*******************************************************************************/
+struct LidarSink {
+  static inline void measure(LidarObject *) {}
+  static inline void velocity(LidarObject *, unsigned long) {}
+  static inline void frame(const LidarCycle &) {}
+};
+
+/*******************************************************************************
+  LidarCallbackSink : default sink, calls the callbacks of the Lidar objects
+  (setCallbackDistance, setCallbackVelocity)
+*******************************************************************************/
+struct LidarCallbackSink : LidarSink {
+  static inline void measure(LidarObject * lidar) {
+    lidar->notify_distance();
+  }
+  static inline void velocity(LidarObject * lidar, unsigned long dt) {
+    lidar->notify_velocity(dt);
+  }
+};
+
+#endif
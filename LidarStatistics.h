@@ -0,0 +1,71 @@
+#ifndef LIDAR_STATISTICS_H
+#define LIDAR_STATISTICS_H
+
+#include <Arduino.h>
+#include "I2CFunctions.h"
+#include "LidarObject.h"
+
+// ENABLE_STATISTICS is defined in I2CFunctions.h
+// spinOnce() histogram, bin i counts the passes under STATISTICS_BIN_US << i µs
+#define STATISTICS_BINS           8
+#define STATISTICS_BIN_US         64
+
+/*******************************************************************************
+  SpinStatistics : time spent per spinOnce() pass
+*******************************************************************************/
+struct SpinStatistics {
+  uint32_t count;   // Number of passes
+  uint32_t total;   // µs spent in all passes
+  uint16_t min;     // Shortest pass in µs
+  uint16_t max;     // Longest pass in µs
+  uint16_t histogram[STATISTICS_BINS];
+
+  void record(unsigned long dt){
+    uint16_t _dt = dt > 0xffff ? 0xffff : dt;
+    if(count == 0 or _dt < min)
+      min = _dt;
+    if(_dt > max)
+      max = _dt;
+    count++;
+    total += dt;
+    uint8_t bin = 0;
+    while(bin < STATISTICS_BINS - 1 and dt >= ((unsigned long) STATISTICS_BIN_US << bin))
+      bin++;
+    histogram[bin]++;
+  };
+
+  void reset(){
+    memset(this, 0, sizeof(SpinStatistics));
+  };
+};
+
+/*******************************************************************************
+  LidarStatistics : samples and time spent in each LIDAR_STATE for one laser
+
+  The sample rate is samples * 1000000 / (micros() - since)
+*******************************************************************************/
+struct LidarStatistics {
+  uint32_t samples;     // Measures read
+  uint16_t recoveries;  // Calls to recover()
+  unsigned long since;  // micros() of the last reset of the statistics
+  unsigned long stateSince; // micros() of the last state change
+  uint32_t stateTime[LIDAR_STATE_COUNT]; // µs spent, by lidarStateIndex
+
+  void changeState(LIDAR_STATE from, unsigned long now){
+    stateTime[lidarStateIndex(from)] += now - stateSince;
+    stateSince = now;
+  };
+
+  float sampleRate(){
+    unsigned long elapsed = micros() - since;
+    return elapsed ? samples * 1000000.0 / elapsed : 0;
+  };
+
+  void reset(unsigned long now){
+    memset(this, 0, sizeof(LidarStatistics));
+    since = now;
+    stateSince = now;
+  };
+};
+
+#endif
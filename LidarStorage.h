@@ -0,0 +1,165 @@
+#ifndef LIDAR_STORAGE_H
+#define LIDAR_STORAGE_H
+
+#include <Arduino.h>
+#include "LidarObject.h"
+
+// Keep the serial and the tuning of each laser in EEPROM, see LidarStorage
+#ifndef ENABLE_STORAGE
+#define ENABLE_STORAGE            false
+#endif
+// First EEPROM byte of the record
+#ifndef LIDAR_STORAGE_ADDRESS
+#define LIDAR_STORAGE_ADDRESS     0
+#endif
+// Format of the record, a record of another version is ignored
+#define LIDAR_STORAGE_MAGIC       0x4c
+#define LIDAR_STORAGE_VERSION     1
+#define LIDAR_STORAGE_HEADER      4
+#define LIDAR_STORAGE_ENTRY       12
+// Largest record, for the cores emulating the EEPROM in flash (EEPROM.begin)
+#define LIDAR_STORAGE_SIZE        (LIDAR_STORAGE_HEADER + 32 * LIDAR_STORAGE_ENTRY)
+
+#if ENABLE_STORAGE
+#include <EEPROM.h>
+
+/*******************************************************************************
+  LidarStorage : the lasers of a LidarController in EEPROM
+
+  The record is a 4 bytes header (magic, version, count, CRC-8 of the
+  entries) and one 12 bytes entry per laser with a known serial:
+
+    serial (2, big endian), address, configuration, adaptiveLevel, offset,
+    filter type, filter minStrength, filter gainA (2), filter gainB (2)
+
+  The entry of a laser is found by its address. Its serial makes the first
+  reset parallel (LidarController::changeAddressBySerial), the rest is
+  written on each configure(). A laser swapped for another one does not
+  answer its serial: it is addressed sequentially, learns the new serial and
+  the next save() stores it. Only the bytes that changed are written.
+*******************************************************************************/
+class LidarStorage {
+  public:
+/*******************************************************************************
+  begin : open the EEPROM and check the record
+
+  returns true if the record is valid (magic, version and CRC)
+*******************************************************************************/
+    static bool begin(){
+#if defined(ESP8266) || defined(ESP32)
+      EEPROM.begin(LIDAR_STORAGE_ADDRESS + LIDAR_STORAGE_SIZE);
+#endif
+      if(read(0) != LIDAR_STORAGE_MAGIC or read(1) != LIDAR_STORAGE_VERSION)
+        return false;
+      uint8_t count = read(2);
+      return count <= 32 and crc(count) == read(3);
+    };
+
+/*******************************************************************************
+  restore : give its stored serial and tuning to a laser, by its address
+
+  returns false if the record has no entry for this address
+*******************************************************************************/
+    static bool restore(LidarObject & lidar){
+      uint8_t count = read(2);
+      for(uint8_t e = 0; e < count; e++){
+        uint16_t at = LIDAR_STORAGE_HEADER + e * LIDAR_STORAGE_ENTRY;
+        if(read(at + 2) != lidar.address)
+          continue;
+        lidar.setSerial(read16(at));
+        lidar.configuration = read(at + 3);
+        lidar.adaptiveLevel = read(at + 4);
+        lidar.offset = (int8_t) read(at + 5);
+#if ENABLE_FILTER
+        lidar.filter.begin((LIDAR_FILTER) read(at + 6), read16(at + 8), read16(at + 10), read(at + 7));
+#endif
+        return true;
+      }
+      return false;
+    };
+
+/*******************************************************************************
+  save : write the record of the lasers (NULL entries and lasers without a
+  serial are skipped)
+
+  returns the number of entries written
+*******************************************************************************/
+    static uint8_t save(LidarObject * const * lidars, uint8_t n){
+      uint8_t count = 0;
+      for(uint8_t i = 0; i < n; i++){
+        LidarObject * lidar = lidars[i];
+        if(lidar == NULL or !lidar->hasSerial)
+          continue;
+        uint16_t at = LIDAR_STORAGE_HEADER + count * LIDAR_STORAGE_ENTRY;
+        write(at, lidar->serial >> 8);
+        write(at + 1, lidar->serial & 0xff);
+        write(at + 2, lidar->address);
+        write(at + 3, lidar->configuration);
+        write(at + 4, lidar->adaptiveLevel);
+        write(at + 5, (uint8_t) lidar->offset);
+#if ENABLE_FILTER
+        write(at + 6, lidar->filter.type);
+        write(at + 7, lidar->filter.minStrength);
+        write(at + 8, lidar->filter.gainA >> 8);
+        write(at + 9, lidar->filter.gainA & 0xff);
+        write(at + 10, lidar->filter.gainB >> 8);
+        write(at + 11, lidar->filter.gainB & 0xff);
+#else
+        for(uint8_t b = 6; b < LIDAR_STORAGE_ENTRY; b++)
+          write(at + b, 0);
+#endif
+        count++;
+      }
+      write(0, LIDAR_STORAGE_MAGIC);
+      write(1, LIDAR_STORAGE_VERSION);
+      write(2, count);
+      write(3, crc(count));
+#if defined(ESP8266) || defined(ESP32)
+      EEPROM.commit();
+#endif
+      return count;
+    };
+
+/*******************************************************************************
+  clear : invalidate the record, the lasers are addressed sequentially on the
+  next boot
+*******************************************************************************/
+    static void clear(){
+      write(0, 0xff);
+#if defined(ESP8266) || defined(ESP32)
+      EEPROM.commit();
+#endif
+    };
+
+  private:
+    static uint8_t read(uint16_t at){
+      return EEPROM.read(LIDAR_STORAGE_ADDRESS + at);
+    };
+
+    static uint16_t read16(uint16_t at){
+      return (read(at) << 8) | read(at + 1);
+    };
+
+    static void write(uint16_t at, uint8_t value){
+      // Skip the unchanged bytes, saves the EEPROM cycles
+      if(read(at) != value)
+        EEPROM.write(LIDAR_STORAGE_ADDRESS + at, value);
+    };
+
+    // CRC-8 (polynomial 0x07) of the count and the entries
+    static uint8_t crc(uint8_t count){
+      uint8_t value = 0;
+      uint16_t end = LIDAR_STORAGE_HEADER + count * LIDAR_STORAGE_ENTRY;
+      for(uint16_t at = 2; at < end; at++){
+        if(at == 3)
+          continue;
+        value ^= read(at);
+        for(uint8_t b = 0; b < 8; b++)
+          value = value & 0x80 ? (value << 1) ^ 0x07 : value << 1;
+      }
+      return value;
+    };
+};
+#endif
+
+#endif
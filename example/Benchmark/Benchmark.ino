@@ -5,16 +5,31 @@
   Benchmark script
   http://static.garmin.com/pumac/LIDAR_Lite_v3_Operation_Manual_and_Technical_Specifications.pdf
 
+  Sweeps the number of lasers (1 to NUMBER_OF_LASERS), the configure()
+  presets, the I2C clock (100kHz, 400kHz) and the bias correction, and prints
+  one CSV line per run:
+
+    config,clock_khz,bias,lasers,hz,hz_laser_min,hz_laser_max,
+    latency_p50_us,latency_p90_us,latency_p99_us,latency_max_us,
+    i2c_error_pct,recoveries,outliers,bus_pct
+
+  hz          : measures per second, all lasers
+  latency     : trigger to callback, percentiles by LATENCY_BIN_US bins
+  i2c_error   : failed transactions over all transactions
+  outliers    : measures out of [MIN_DISTANCE, MAX_DISTANCE]
+  bus_pct     : time spent in I2C transactions over the run time
+
+  Lines starting by # are comments.
+
 ------------------------------------------------------------------------------*/
 
+#define ENABLE_STATISTICS true
+
 #include <Wire.h>
-#include <I2CFunctions.h> 
+#include <I2CFunctions.h>
 #include <LidarObject.h>
 #include <LidarController.h>
 
-#define LIDARLITE_ADDR_DEFAULT 0x62
-
-#define WIRE400K true
 #define Z1_LASER_TRIG 11
 #define Z2_LASER_TRIG 8
 #define Z3_LASER_TRIG 5
@@ -28,7 +43,7 @@
 #define Z4_LASER_EN 3
 #define Z5_LASER_EN 15
 #define Z6_LASER_EN 18
-// Defines laser mode 
+// Defines laser mode
 #define Z1_LASER_PIN 13
 #define Z2_LASER_PIN 10
 #define Z3_LASER_PIN 7
@@ -45,20 +60,31 @@
 #define Z5_LASER_AD 0x6C
 #define Z6_LASER_AD 0x64
 
-#define NUMBER_OF_LASERS 5
-
+#define NUMBER_OF_LASERS 4
+// Number of configure() presets swept, from 0
+#define NUMBER_OF_CONFIGURATIONS 6
+// Duration of one run and maximal time to get the lasers back after a reset
+#define RUN_DURATION_MS 1000
+#define SETTLE_TIMEOUT_MS 500
+// Measures out of this range (cm) are counted as outliers
+#define MIN_DISTANCE 50
+#define MAX_DISTANCE 500
+// Latency histogram, the last bin counts everything above
+#define LATENCY_BINS 64
+#define LATENCY_BIN_US 100
 
 static LidarController Controller;
 static LidarObject LZ1;
 static LidarObject LZ2;
 static LidarObject LZ3;
 static LidarObject LZ4;
+static LidarObject* lasers[NUMBER_OF_LASERS] = {&LZ1, &LZ2, &LZ3, &LZ4};
 
-long now, last;
-int errors = 0;
-long measureCount = 0;
+static const unsigned long clocks[2] = {100000UL, 400000UL};
 
-#define N_MEASURE_PROFILE 1000.0
+uint16_t latency[LATENCY_BINS];
+unsigned long latencyMax = 0;
+uint32_t outliers = 0;
 
 void setup()
 {
@@ -68,78 +94,148 @@ void setup()
   LZ3.begin(Z3_LASER_EN, Z3_LASER_PIN, Z3_LASER_TRIG, Z3_LASER_AD, 2, DISTANCE, 'C');
   LZ4.begin(Z4_LASER_EN, Z4_LASER_PIN, Z4_LASER_TRIG, Z4_LASER_AD, 2, DISTANCE, 'D');
 
-  LZ1.setCallbackDistance(&distance_callback);
-  LZ2.setCallbackDistance(&distance_callback);
-  LZ3.setCallbackDistance(&distance_callback);
-  LZ4.setCallbackDistance(&distance_callback);
-  
-  Controller.add(&LZ1, 0);
-  Controller.add(&LZ2, 1);
-  Controller.add(&LZ3, 2);
-  Controller.add(&LZ4, 3);
+  for(uint8_t j = 0; j < NUMBER_OF_LASERS; j++)
+    lasers[j]->setCallbackDistance(&distance_callback);
+
   delay(100);
-  Controller.begin(WIRE400K);
+  Controller.begin(true);
   delay(100);
 }
 
 void distance_callback(LidarObject* self){
-  measureCount++;
-  isError(self);
-  /*Serial.print(self->name);
-  Serial.print(":");
-  Serial.println(self->distance);*/
+  unsigned long dt = micros() - self->sampleTime;
+  unsigned long bin = dt / LATENCY_BIN_US;
+  latency[bin < LATENCY_BINS ? bin : LATENCY_BINS - 1]++;
+  if(dt > latencyMax)
+    latencyMax = dt;
+  if(self->distance > MAX_DISTANCE or self->distance < MIN_DISTANCE)
+    outliers++;
 }
 
 void loop()
 {
-  Serial.println("Starting...");
-  
-  for(int conf = 0; conf < 6; conf++){
-    //reconfigure(conf);
-    last = micros();
-    for(long i = 0; i < 1000; i++){
-      Controller.spinOnce(false);
+  Serial.println("# Starting...");
+  Serial.println("config,clock_khz,bias,lasers,hz,hz_laser_min,hz_laser_max,latency_p50_us,latency_p90_us,latency_p99_us,latency_max_us,i2c_error_pct,recoveries,outliers,bus_pct");
+
+  // The lasers are added one by one, the others stay powered off
+  for(uint8_t n = 1; n <= NUMBER_OF_LASERS; n++){
+    Controller.add(lasers[n - 1], n - 1);
+    for(uint8_t conf = 0; conf < NUMBER_OF_CONFIGURATIONS; conf++){
+      for(uint8_t c = 0; c < 2; c++){
+        Wire.setClock(clocks[c]);
+        reconfigure(n, conf);
+        for(uint8_t bias = 0; bias < 2; bias++)
+          run(n, conf, clocks[c], bias);
+      }
     }
-    now = micros();
-    Serial.print("Configuration ");
-    Serial.print(conf);
-    Serial.print(" spinOnce() : ");
-    Serial.print(measureCount*1000000.0/double(now-last));
-    Serial.print("Hz, errors : ");
-    Serial.print(errors);
-    Serial.print(" on ");
-    Serial.print(measureCount);
-    Serial.println(" measurements ");
-    errors = 0;
-    measureCount=0;
-  }
-}
-
-void isError(LidarObject* self){
-  if(self->distance > 500) {
-    errors++;
-    Serial.print(self->name);
-    Serial.print(":");
-    Serial.println(self->distance);
-  } else if(self->distance < 50){
-    errors++;
-    Serial.print(self->name);
-    Serial.print(":");
-    Serial.println(self->distance);
   }
+  while(true);
 }
 
-void reconfigure(int conf){
-  for(int j = 0; j < 4; j++){
+/*******************************************************************************
+  reconfigure : Reset the n first lasers with the configuration conf and wait
+  for them to be acquiring again
+*******************************************************************************/
+void reconfigure(uint8_t n, uint8_t conf){
+  for(uint8_t j = 0; j < n; j++){
     Controller.lidars[j]->configuration = conf;
     Controller.resetLidar(j);
   }
-  
-  for(int j = 0; j < 4; j++){
-    Controller.spinOnce();
-    delay(20);
-    Controller.spinOnce();
-    delay(20);
+
+  unsigned long start = millis();
+  while(millis() - start < SETTLE_TIMEOUT_MS){
     Controller.spinOnce();
+    uint8_t ready = 0;
+    for(uint8_t j = 0; j < n; j++){
+      if(Controller.getState(j) == ACQUISITION_IN_PROGRESS)
+        ready++;
+    }
+    if(ready == n)
+      break;
+  }
+}
+
+/*******************************************************************************
+  run : Measure RUN_DURATION_MS of spinOnce() and print the CSV line
+*******************************************************************************/
+void run(uint8_t n, uint8_t conf, unsigned long clock, bool bias){
+  memset(latency, 0, sizeof(latency));
+  latencyMax = 0;
+  outliers = 0;
+  Controller.resetStatistics();
+
+  unsigned long start = micros();
+  while(micros() - start < RUN_DURATION_MS * 1000UL)
+    Controller.spinOnce(bias);
+  unsigned long elapsed = micros() - start;
+
+  uint32_t samples = 0;
+  uint16_t recoveries = 0;
+  float minRate = 0, maxRate = 0;
+  for(uint8_t j = 0; j < n; j++){
+    float rate = Controller.lidarStatistics[j].samples * 1000000.0 / elapsed;
+    if(j == 0 or rate < minRate)
+      minRate = rate;
+    if(j == 0 or rate > maxRate)
+      maxRate = rate;
+    samples += Controller.lidarStatistics[j].samples;
+    recoveries += Controller.lidarStatistics[j].recoveries;
+  }
+
+  I2CStatistics & bus = I2C.statistics;
+  uint32_t transactions = bus.count[I2C_WRITE] + bus.count[I2C_READ] + bus.count[I2C_PROBE];
+  uint32_t busTime = bus.time[I2C_WRITE] + bus.time[I2C_READ] + bus.time[I2C_PROBE];
+  uint32_t errors = 0;
+  for(uint8_t e = 1; e < I2C_ERROR_CODES; e++)
+    errors += bus.errors[e];
+
+  Serial.print(conf);
+  Serial.print(",");
+  Serial.print(clock / 1000);
+  Serial.print(",");
+  Serial.print(bias ? 1 : 0);
+  Serial.print(",");
+  Serial.print(n);
+  Serial.print(",");
+  Serial.print(samples * 1000000.0 / elapsed, 1);
+  Serial.print(",");
+  Serial.print(minRate, 1);
+  Serial.print(",");
+  Serial.print(maxRate, 1);
+  Serial.print(",");
+  Serial.print(percentile(50));
+  Serial.print(",");
+  Serial.print(percentile(90));
+  Serial.print(",");
+  Serial.print(percentile(99));
+  Serial.print(",");
+  Serial.print(latencyMax);
+  Serial.print(",");
+  Serial.print(transactions ? errors * 100.0 / transactions : 0, 2);
+  Serial.print(",");
+  Serial.print(recoveries);
+  Serial.print(",");
+  Serial.print(outliers);
+  Serial.print(",");
+  Serial.println(busTime * 100.0 / elapsed, 1);
+}
+
+/*******************************************************************************
+  percentile : Upper bound (µs) of the latency bin holding the p-th percentile
+  of the measures, bounded by the maximal latency
+*******************************************************************************/
+unsigned long percentile(uint8_t p){
+  uint32_t total = 0;
+  for(uint8_t bin = 0; bin < LATENCY_BINS; bin++)
+    total += latency[bin];
+  if(total == 0)
+    return 0;
+  uint32_t rank = (total * p + 99) / 100;
+  uint32_t seen = 0;
+  for(uint8_t bin = 0; bin < LATENCY_BINS - 1; bin++){
+    seen += latency[bin];
+    if(seen >= rank)
+      return min((unsigned long) (bin + 1) * LATENCY_BIN_US, latencyMax);
   }
+  return latencyMax;
 }
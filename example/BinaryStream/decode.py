@@ -0,0 +1,74 @@
+#!/usr/bin/env python
+"""
+Host side decoder of the LidarFrame binary frames (see API_depth.md)
+
+  python decode.py /dev/ttyACM0 115200
+
+Needs pyserial. Prints one line per frame: sequence, frame timestamp and
+distance/strength/state of each laser.
+"""
+import struct
+import sys
+
+SYNC = b'\xaa\x55'
+HEADER = struct.Struct('<BBBBI')  # version, board, sequence, count, timestamp
+LASER = struct.Struct('<hBBI')    # distance, strength, state, timestamp
+
+
+def crc16(data, crc=0xffff):
+    """CRC-16/CCITT-FALSE, as LidarFrame::crc16"""
+    for byte in bytearray(data):
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xffff
+    return crc
+
+
+class FrameDecoder(object):
+    """Feed bytes, get the decoded frames, resynchronizes on sync bytes"""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.errors = 0
+
+    def feed(self, data):
+        self.buffer.extend(data)
+        frames = []
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                del self.buffer[:-1]
+                return frames
+            del self.buffer[:start]
+            if len(self.buffer) < 2 + HEADER.size:
+                return frames
+            version, board, sequence, count, timestamp = HEADER.unpack_from(self.buffer, 2)
+            length = 2 + HEADER.size + count * LASER.size + 2
+            if len(self.buffer) < length:
+                return frames
+            crc, = struct.unpack_from('<H', self.buffer, length - 2)
+            if version != 1 or crc != crc16(self.buffer[2:length - 2]):
+                # Not a frame, look for the next sync bytes
+                self.errors += 1
+                del self.buffer[:1]
+                continue
+            lasers = [LASER.unpack_from(self.buffer, 2 + HEADER.size + i * LASER.size)
+                      for i in range(count)]
+            frames.append({'board': board, 'sequence': sequence,
+                           'timestamp': timestamp, 'lasers': lasers})
+            del self.buffer[:length]
+
+
+def main():
+    import serial
+    port = serial.Serial(sys.argv[1], int(sys.argv[2]) if len(sys.argv) > 2 else 115200)
+    decoder = FrameDecoder()
+    while True:
+        for frame in decoder.feed(port.read(port.in_waiting or 1)):
+            print('%3d %10d %s' % (frame['sequence'], frame['timestamp'],
+                  ' '.join('%5d/%3d/%3d' % laser[:3] for laser in frame['lasers'])))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,87 @@
+// The results of all the lasers once per cycle, through a sink inlined at
+// compile time instead of a callback per measure
+#include "LidarObject.h"
+#include "LidarController.h"
+#include "I2CFunctions.h"
+
+#include <Wire.h>
+#define WIRE400K true
+/*** Defines : CONFIGURATION ***/
+// Defines Trigger
+#define Z1_LASER_TRIG 11
+#define Z2_LASER_TRIG 8
+// Defines power enable lines of laser
+#define Z1_LASER_EN 12
+#define Z2_LASER_EN 9
+// Defines laser mode 
+#define Z1_LASER_PIN 13
+#define Z2_LASER_PIN 10
+//Define address of lasers
+//Thoses are written during initialisation
+// default address : 0x62
+#define Z1_LASER_AD 0x6E
+#define Z2_LASER_AD 0x66
+
+#define NUMBER_OF_LASERS 2
+
+// Maximum datarate
+#define DATARATE 20
+// Actual wait between communications 100Hz = 10ms
+#define DELAY_SEND_MICROS 1000000/DATARATE
+
+// Last results, copied by the sink inside spinOnce() and printed by the loop
+int16_t distances[NUMBER_OF_LASERS];
+unsigned long measures = 0;
+unsigned long cycles = 0;
+
+struct CopySink : LidarSink {
+  static inline void measure(LidarObject * lidar) {
+    measures++;
+  }
+  static inline void frame(const LidarCycle & cycle) {
+    memcpy(distances, cycle.distances, sizeof(distances));
+    cycles++;
+  }
+};
+
+// Lidars
+static LidarControllerN<NUMBER_OF_LASERS, CopySink> Controller;
+static LidarObject LZ1;
+static LidarObject LZ2;
+
+// Delays
+long now, last;
+
+void beginLidars() {
+  // Initialisation of the lidars objects
+  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE, 'A');
+  LZ2.begin(Z2_LASER_EN, Z2_LASER_PIN, Z2_LASER_TRIG, Z2_LASER_AD, 2, DISTANCE, 'B');
+  // Initialisation of the controller
+  Controller.begin(WIRE400K);
+  delay(100);
+  Controller.add(&LZ1, 0);
+  Controller.add(&LZ2, 1);
+}
+
+void setup() {
+  Serial.begin(57600);
+  while (!Serial);
+  beginLidars();
+  last = micros();
+}
+
+void loop() {
+  Controller.spinOnce();
+  now = micros();
+  if(now - last > DELAY_SEND_MICROS){
+    last = micros();
+    Serial.print(cycles);
+    Serial.print("\t");
+    Serial.print(measures);
+    for(uint8_t i = 0; i < NUMBER_OF_LASERS; i++){
+      Serial.print("\t");
+      Serial.print(distances[i]);
+    }
+    Serial.println();
+  }
+}
@@ -0,0 +1,93 @@
+// Coordinator of several boards (needs a Mega, Serial1 and Serial2): pulses
+// the sync line, gives its time to the nodes (example/LinkNode) and writes one
+// merged binary frame per period to the host, its lasers then the ones of
+// the nodes, all in its own time. decode.py (example/BinaryStream) reads it.
+//   Serial1 TX -> RX of every node, node 1 TX -> Serial1 RX, node 2 TX ->
+//   Serial2 RX, LINK_SYNC_PIN -> LINK_SYNC_PIN of every node, common ground
+// Lasers of the merged frame: 4 here and 3 per node
+#define LIDAR_FRAME_MAX_LASERS 10
+
+#include "LidarObject.h"
+#include "LidarController.h"
+#include "I2CFunctions.h"
+#include "LidarLink.h"
+
+#include <Wire.h>
+#define WIRE400K true
+/*** Defines : CONFIGURATION ***/
+// Defines Trigger, wired to the mode pin of the laser through a 1k resistor
+#define Z1_LASER_TRIG 11
+#define Z2_LASER_TRIG 8
+#define Z3_LASER_TRIG 5
+#define Z4_LASER_TRIG 2
+// Defines power enable lines of laser
+#define Z1_LASER_EN 12
+#define Z2_LASER_EN 9
+#define Z3_LASER_EN 6
+#define Z4_LASER_EN 3
+// Defines laser mode 
+#define Z1_LASER_PIN 13
+#define Z2_LASER_PIN 10
+#define Z3_LASER_PIN 7
+#define Z4_LASER_PIN 4
+//Define address of lasers
+//Thoses are written during initialisation
+// default address : 0x62
+#define Z1_LASER_AD 0x6E
+#define Z2_LASER_AD 0x66
+#define Z3_LASER_AD 0x68
+#define Z4_LASER_AD 0x6A
+
+#define NUMBER_OF_LASERS 4
+#define NUMBER_OF_NODES 2
+#define LASERS_PER_NODE 3
+
+// Link: sync line, period of the frames (50Hz) and baudrate of the nodes
+#define LINK_SYNC_PIN 24
+#define LINK_PERIOD_MICROS 20000
+#define LINK_BAUD 500000
+
+// Lidars
+static LidarControllerN<NUMBER_OF_LASERS> Controller;
+static LidarObject LZ1;
+static LidarObject LZ2;
+static LidarObject LZ3;
+static LidarObject LZ4;
+
+static LidarLinkCoordinator<NUMBER_OF_NODES> Link;
+
+void beginLidars() {
+  // Initialisation of the lidars objects
+  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE, 'x');
+  LZ2.begin(Z2_LASER_EN, Z2_LASER_PIN, Z2_LASER_TRIG, Z2_LASER_AD, 2, DISTANCE, 'X');
+  LZ3.begin(Z3_LASER_EN, Z3_LASER_PIN, Z3_LASER_TRIG, Z3_LASER_AD, 2, DISTANCE, 'y');
+  LZ4.begin(Z4_LASER_EN, Z4_LASER_PIN, Z4_LASER_TRIG, Z4_LASER_AD, 2, DISTANCE, 'Y');
+  
+  // Initialisation of the controller
+  Controller.begin(WIRE400K);
+  delay(100);
+  Controller.add(&LZ1, 0);
+  Controller.add(&LZ2, 1);
+  Controller.add(&LZ3, 2);
+  Controller.add(&LZ4, 3);
+  for(uint8_t i = 0; i < NUMBER_OF_LASERS; i++)
+    Controller.synchronize(i);
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial1.begin(LINK_BAUD);
+  Serial2.begin(LINK_BAUD);
+  while (!Serial);
+  beginLidars();
+  // The group is triggered by the pulses of the sync line from now on
+  Link.begin(Controller, LINK_SYNC_PIN, LINK_PERIOD_MICROS, NUMBER_OF_LASERS);
+  Link.addNode(Serial1, LASERS_PER_NODE);
+  Link.addNode(Serial2, LASERS_PER_NODE);
+}
+
+void loop() {
+  Controller.spinOnce();
+  // Time frames on Serial1, merged frames on Serial, never blocks
+  Link.spin(Controller, Serial1, Serial);
+}
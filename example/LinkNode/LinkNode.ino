@@ -0,0 +1,77 @@
+// Node of several boards, driven by example/LinkCoordinator: its lasers are
+// triggered by the sync line and its frames are sent to the coordinator on
+// Serial, timestamped in the time of the coordinator. Set LINK_BOARD to 1 on
+// the node wired to Serial1 of the coordinator, 2 on the one of Serial2
+#include "LidarObject.h"
+#include "LidarController.h"
+#include "I2CFunctions.h"
+#include "LidarLink.h"
+
+#include <Wire.h>
+#define WIRE400K true
+/*** Defines : CONFIGURATION ***/
+// Defines Trigger, wired to the mode pin of the laser through a 1k resistor
+#define Z1_LASER_TRIG 11
+#define Z2_LASER_TRIG 8
+#define Z3_LASER_TRIG 5
+// Defines power enable lines of laser
+#define Z1_LASER_EN 12
+#define Z2_LASER_EN 9
+#define Z3_LASER_EN 6
+// Defines laser mode 
+#define Z1_LASER_PIN 13
+#define Z2_LASER_PIN 10
+#define Z3_LASER_PIN 7
+//Define address of lasers
+//Thoses are written during initialisation
+// default address : 0x62
+#define Z1_LASER_AD 0x6E
+#define Z2_LASER_AD 0x66
+#define Z3_LASER_AD 0x68
+
+#define NUMBER_OF_LASERS 3
+
+// Link: board id, sync line (on an interrupt pin, 2 on the Uno) and baudrate
+#define LINK_BOARD 1
+#define LINK_SYNC_PIN 2
+#define LINK_BAUD 500000
+
+// Lidars
+static LidarControllerN<NUMBER_OF_LASERS> Controller;
+static LidarObject LZ1;
+static LidarObject LZ2;
+static LidarObject LZ3;
+
+static LidarLinkNode Link(LINK_BOARD);
+
+// Rising edges of the sync line
+void syncEdge() { Link.syncEdge(); }
+
+void beginLidars() {
+  // Initialisation of the lidars objects
+  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE, 'x');
+  LZ2.begin(Z2_LASER_EN, Z2_LASER_PIN, Z2_LASER_TRIG, Z2_LASER_AD, 2, DISTANCE, 'X');
+  LZ3.begin(Z3_LASER_EN, Z3_LASER_PIN, Z3_LASER_TRIG, Z3_LASER_AD, 2, DISTANCE, 'y');
+  
+  // Initialisation of the controller
+  Controller.begin(WIRE400K);
+  delay(100);
+  Controller.add(&LZ1, 0);
+  Controller.add(&LZ2, 1);
+  Controller.add(&LZ3, 2);
+  for(uint8_t i = 0; i < NUMBER_OF_LASERS; i++)
+    Controller.synchronize(i);
+}
+
+void setup() {
+  // The link to the coordinator, nothing else may be printed on Serial
+  Serial.begin(LINK_BAUD);
+  beginLidars();
+  Link.begin(Controller, LINK_SYNC_PIN);
+  attachInterrupt(digitalPinToInterrupt(LINK_SYNC_PIN), syncEdge, RISING);
+}
+
+void loop() {
+  Controller.spinOnce();
+  Link.spin(Controller, Serial);
+}
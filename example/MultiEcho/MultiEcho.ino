@@ -0,0 +1,105 @@
+// Scheduled lasers wait for their tick after each measure, the correlation
+// record stays valid until then
+#define ENABLE_SCHEDULER true
+
+#include "LidarObject.h"
+#include "LidarController.h"
+#include "I2CFunctions.h"
+
+#include <Wire.h>
+#define WIRE400K true
+/*** Defines : CONFIGURATION ***/
+// Defines Trigger
+#define Z1_LASER_TRIG 11
+// Defines power enable lines of laser
+#define Z1_LASER_EN 12
+// Defines laser mode 
+#define Z1_LASER_PIN 13
+//Define address of lasers
+//Thoses are written during initialisation
+// default address : 0x62
+#define Z1_LASER_AD 0x6E
+
+// One record every 100ms, the readout takes about 40ms
+#define LASER_RATE 10
+#define LASER_PERIOD_MICROS 1000000/LASER_RATE
+// Minimal value of a peak over the noise floor, and distance between two peaks
+#define PEAK_MARGIN 8
+#define PEAK_SEPARATION 8
+
+// Lidars
+static LidarController Controller;
+static LidarObject LZ1;
+static LidarPeakFinder Peaks;
+
+#if defined(__AVR__) and defined(TIMSK1)
+// Timer1 ticks every SCHEDULER_TICK_US
+ISR(TIMER1_COMPA_vect) {
+  Controller.tick();
+}
+#else
+// No Timer1, tick from the loop
+long lastTick;
+#endif
+
+bool newMeasure = false;
+
+void distance_callback(LidarObject* self){
+  newMeasure = true;
+}
+
+void beginLidars() {
+  // Initialisation of the lidars objects
+  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE, 'x');
+  LZ1.setCallbackDistance(&distance_callback);
+  
+  // Initialisation of the controller
+  Controller.begin(WIRE400K);
+  delay(100);
+  Controller.add(&LZ1, 0);
+  Controller.schedule(0, LASER_PERIOD_MICROS);
+}
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial);
+  beginLidars();
+#if defined(__AVR__) and defined(TIMSK1)
+  Controller.beginSchedulerTimer();
+#else
+  lastTick = micros();
+#endif
+}
+
+void loop() {
+#if !(defined(__AVR__) and defined(TIMSK1))
+  while(micros() - lastTick >= SCHEDULER_TICK_US){
+    lastTick += SCHEDULER_TICK_US;
+    Controller.tick();
+  }
+#endif
+  Controller.spinOnce();
+  if(newMeasure and Controller.getState(0) == WAITING_TRIGGER){
+    newMeasure = false;
+    echoes();
+  }
+}
+
+// Print the distance and the first and second returns of the record
+void echoes(){
+  uint8_t noise = 0;
+  if(I2C.readByte(LZ1.address, REG_NOISE_PEAK, &noise))
+    return;
+  Peaks.begin(noise + PEAK_MARGIN, PEAK_SEPARATION);
+  if(Controller.correlationRecord(0, Peaks))
+    return;
+  Serial.print(LZ1.distance);
+  for(uint8_t p = 0; p < Peaks.count(); p++){
+    LidarEcho echo = p == 0 ? Peaks.first() : Peaks.second();
+    Serial.print("\t");
+    Serial.print(echo.index);
+    Serial.print(":");
+    Serial.print(echo.value);
+  }
+  Serial.println();
+}
@@ -0,0 +1,76 @@
+// The distances are read from the PWM output of the lasers (10us/cm on the
+// mode pin), measured by interrupts: no I2C transaction per measure, the
+// lasers measure in parallel. I2C only addresses and configures them.
+#include "LidarObject.h"
+#include "LidarController.h"
+#include "I2CFunctions.h"
+
+#include <Wire.h>
+#define WIRE400K true
+/*** Defines : CONFIGURATION ***/
+// Defines Trigger, to the mode pin through a 1k resistor
+#define Z1_LASER_TRIG 11
+#define Z2_LASER_TRIG 8
+// Defines power enable lines of laser
+#define Z1_LASER_EN 12
+#define Z2_LASER_EN 9
+// Defines laser mode, on interrupt pins (2 and 3 on the Uno)
+#define Z1_LASER_PIN 2
+#define Z2_LASER_PIN 3
+//Define address of lasers
+//Thoses are written during initialisation
+// default address : 0x62
+#define Z1_LASER_AD 0x6E
+#define Z2_LASER_AD 0x66
+
+#define NUMBER_OF_LASERS 2
+
+// Maximum datarate
+#define DATARATE 20
+// Actual wait between communications 100Hz = 10ms
+#define DELAY_SEND_MICROS 1000000/DATARATE
+
+// Lidars
+static LidarControllerN<NUMBER_OF_LASERS> Controller;
+static LidarObject LZ1;
+static LidarObject LZ2;
+
+// Delays
+long now, last;
+
+// Edges of the mode pins
+void pwmZ1() { LZ1.pwmEdge(); }
+void pwmZ2() { LZ2.pwmEdge(); }
+
+void beginLidars() {
+  // Initialisation of the lidars objects
+  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE, 'A');
+  LZ2.begin(Z2_LASER_EN, Z2_LASER_PIN, Z2_LASER_TRIG, Z2_LASER_AD, 2, DISTANCE, 'B');
+  LZ1.beginPWM();
+  LZ2.beginPWM();
+  attachInterrupt(digitalPinToInterrupt(Z1_LASER_PIN), pwmZ1, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(Z2_LASER_PIN), pwmZ2, CHANGE);
+  // Initialisation of the controller
+  Controller.begin(WIRE400K);
+  delay(100);
+  Controller.add(&LZ1, 0);
+  Controller.add(&LZ2, 1);
+}
+
+void setup() {
+  Serial.begin(57600);
+  while (!Serial);
+  beginLidars();
+  last = micros();
+}
+
+void loop() {
+  Controller.spinOnce();
+  now = micros();
+  if(now - last > DELAY_SEND_MICROS){
+    last = micros();
+    Serial.print(LZ1.distance);
+    Serial.print("\t");
+    Serial.println(LZ2.distance);
+  }
+}
@@ -75,9 +75,6 @@ long now, last;
 // ROS Communication
 ros::NodeHandle nh;
 static flyingros_msgs::MultiEcho distance_msg;
-static int16_t distances[6] = {0,0,0,0,0,0};
-static uint8_t strengths[6] = {0,0,0,0,0,0};
-static uint8_t statuses[6] = {0,0,0,0,0,0};
 
 ros::Publisher distance_publisher("/flyingros/lasers/raw", &distance_msg);
 
@@ -123,19 +120,17 @@ void laserpublish(){
   /*if(!nh.connected()){
     return;
   }*/
-  for(uint8_t i = 0; i < NUMBER_OF_LASERS; i++){
-    distances[i] = Controller.lidars[i]->distance;
-    strengths[i] = Controller.lidars[i]->strength;
-    statuses[i] = Controller.lidars[i]->lidar_state;
-  }
+  // The message points to the controller frame, no copy. It does not change
+  // until the next swapBuffers()
+  Controller.swapBuffers();
 
   distance_msg.measures_length = NUMBER_OF_LASERS;
   distance_msg.strengths_length = NUMBER_OF_LASERS;
   distance_msg.statuses_length = NUMBER_OF_LASERS;
   
-  distance_msg.measures = distances;
-  distance_msg.strengths = strengths;
-  distance_msg.statuses = statuses;
+  distance_msg.measures = Controller.frameDistances();
+  distance_msg.strengths = Controller.frameStrengths();
+  distance_msg.statuses = Controller.frameStates();
   
   distance_publisher.publish(&distance_msg);
 }
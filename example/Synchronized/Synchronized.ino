@@ -0,0 +1,81 @@
+// Trigger the lasers together by their trigger pin and print one frame per
+// acquisition, all the measures of a frame share the same trigger time
+#include "LidarObject.h"
+#include "LidarController.h"
+#include "I2CFunctions.h"
+
+#include <Wire.h>
+#define WIRE400K true
+/*** Defines : CONFIGURATION ***/
+// Defines Trigger, wired to the mode pin of the laser through a 1k resistor
+// Pins of the same port are pulsed by a single write
+#define Z1_LASER_TRIG 11
+#define Z2_LASER_TRIG 8
+#define Z3_LASER_TRIG 5
+#define Z4_LASER_TRIG 2
+// Defines power enable lines of laser
+#define Z1_LASER_EN 12
+#define Z2_LASER_EN 9
+#define Z3_LASER_EN 6
+#define Z4_LASER_EN 3
+// Defines laser mode 
+#define Z1_LASER_PIN 13
+#define Z2_LASER_PIN 10
+#define Z3_LASER_PIN 7
+#define Z4_LASER_PIN 4
+//Define address of lasers
+//Thoses are written during initialisation
+// default address : 0x62
+#define Z1_LASER_AD 0x6E
+#define Z2_LASER_AD 0x66
+#define Z3_LASER_AD 0x68
+#define Z4_LASER_AD 0x6A
+
+#define NUMBER_OF_LASERS 4
+
+// Lidars
+static LidarController Controller;
+static LidarObject LZ1;
+static LidarObject LZ2;
+static LidarObject LZ3;
+static LidarObject LZ4;
+
+void beginLidars() {
+  // Initialisation of the lidars objects
+  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE, 'x');
+  LZ2.begin(Z2_LASER_EN, Z2_LASER_PIN, Z2_LASER_TRIG, Z2_LASER_AD, 2, DISTANCE, 'X');
+  LZ3.begin(Z3_LASER_EN, Z3_LASER_PIN, Z3_LASER_TRIG, Z3_LASER_AD, 2, DISTANCE, 'y');
+  LZ4.begin(Z4_LASER_EN, Z4_LASER_PIN, Z4_LASER_TRIG, Z4_LASER_AD, 2, DISTANCE, 'Y');
+  
+  // Initialisation of the controller
+  Controller.begin(WIRE400K);
+  delay(100);
+  Controller.add(&LZ1, 0);
+  Controller.add(&LZ2, 1);
+  Controller.add(&LZ3, 2);
+  Controller.add(&LZ4, 3);
+  for(uint8_t i = 0; i < NUMBER_OF_LASERS; i++)
+    Controller.synchronize(i);
+}
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial);
+  beginLidars();
+}
+
+void loop() {
+  Controller.spinOnce();
+  if(Controller.syncFrame())
+    frameprint();
+}
+
+void frameprint(){
+  int16_t * distances = Controller.frameDistances();
+  Serial.print(Controller.frameTime());
+  for(uint8_t i = 0; i < NUMBER_OF_LASERS; i++){
+    Serial.print("\t");
+    Serial.print(distances[i]);
+  }
+  Serial.println();
+}
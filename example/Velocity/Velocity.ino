@@ -51,15 +51,28 @@ static LidarObject LZ2;
 // Delays
 long now, last;
 
+// Called on every velocity measure, dt is the time since the last one (µs)
+void velocity_callback(LidarObject* self, unsigned long dt){
+  Serial.print(self->name);
+  Serial.print("\t");
+  Serial.print(dt);
+  Serial.print("\t");
+  Serial.println(self->velocity);
+}
+
 void beginLidars() {
   // Initialisation of the lidars objects
-  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE, 'x');
-  LZ2.begin(Z2_LASER_EN, Z2_LASER_PIN, Z2_LASER_TRIG, Z2_LASER_AD, 2, DISTANCE, 'X');
+  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE_AND_VELOCITY, 'x');
+  LZ2.begin(Z2_LASER_EN, Z2_LASER_PIN, Z2_LASER_TRIG, Z2_LASER_AD, 2, VELOCITY, 'X');
+  LZ2.setCallbackVelocity(&velocity_callback);
   // Initialisation of the controller
   Controller.begin(WIRE400K);
   delay(100);
   Controller.add(&LZ1, 0);
   Controller.add(&LZ2, 1);
+  // Velocity measured over 20ms, 0.5 m/s per count
+  Controller.scale(0, 0x28);
+  Controller.scale(1, 0x28);
 }
 
 void setup() {
@@ -0,0 +1,92 @@
+// The serials and the tuning of the lasers are kept in EEPROM: from the
+// second boot, the lasers are addressed together instead of one after the
+// other. Send 'c' to forget them.
+#define ENABLE_STORAGE true
+#include <EEPROM.h>
+#include "LidarObject.h"
+#include "LidarController.h"
+#include "I2CFunctions.h"
+
+#include <Wire.h>
+#define WIRE400K true
+/*** Defines : CONFIGURATION ***/
+// Defines Trigger
+#define Z1_LASER_TRIG 11
+#define Z2_LASER_TRIG 8
+#define Z3_LASER_TRIG 5
+#define Z4_LASER_TRIG 2
+// Defines power enable lines of laser
+#define Z1_LASER_EN 12
+#define Z2_LASER_EN 9
+#define Z3_LASER_EN 6
+#define Z4_LASER_EN 3
+// Defines laser mode 
+#define Z1_LASER_PIN 13
+#define Z2_LASER_PIN 10
+#define Z3_LASER_PIN 7
+#define Z4_LASER_PIN 4
+//Define address of lasers
+//Thoses are written during initialisation
+// default address : 0x62
+#define Z1_LASER_AD 0x6E
+#define Z2_LASER_AD 0x66
+#define Z3_LASER_AD 0x68
+#define Z4_LASER_AD 0x6A
+
+#define NUMBER_OF_LASERS 4
+
+// Lidars
+static LidarControllerN<NUMBER_OF_LASERS> Controller;
+static LidarObject LZ1;
+static LidarObject LZ2;
+static LidarObject LZ3;
+static LidarObject LZ4;
+
+unsigned long start;
+bool ready = false;
+
+void beginLidars() {
+  // Initialisation of the lidars objects
+  LZ1.begin(Z1_LASER_EN, Z1_LASER_PIN, Z1_LASER_TRIG, Z1_LASER_AD, 2, DISTANCE, 'A');
+  LZ2.begin(Z2_LASER_EN, Z2_LASER_PIN, Z2_LASER_TRIG, Z2_LASER_AD, 2, DISTANCE, 'B');
+  LZ3.begin(Z3_LASER_EN, Z3_LASER_PIN, Z3_LASER_TRIG, Z3_LASER_AD, 2, DISTANCE, 'C');
+  LZ4.begin(Z4_LASER_EN, Z4_LASER_PIN, Z4_LASER_TRIG, Z4_LASER_AD, 2, DISTANCE, 'D');
+  // Initialisation of the controller, reads the EEPROM record
+  Controller.begin(WIRE400K);
+  delay(100);
+  // The stored serials and tuning are restored here
+  Controller.add(&LZ1, 0);
+  Controller.add(&LZ2, 1);
+  Controller.add(&LZ3, 2);
+  Controller.add(&LZ4, 3);
+}
+
+void setup() {
+  Serial.begin(57600);
+  while (!Serial);
+  start = micros();
+  beginLidars();
+}
+
+void loop() {
+  Controller.spinOnce();
+  if (!ready) {
+    uint8_t acquiring = 0;
+    for (uint8_t i = 0; i < NUMBER_OF_LASERS; i++)
+      acquiring += Controller.getState(i) == ACQUISITION_IN_PROGRESS;
+    if (acquiring == NUMBER_OF_LASERS) {
+      ready = true;
+      Serial.print("Ready in ");
+      Serial.print(micros() - start);
+      Serial.println(" us");
+      // The serials are known now, only the changes are written
+      Serial.print("Saved ");
+      Serial.print(Controller.save());
+      Serial.println(" lasers");
+    }
+  }
+  if (Serial.available() and Serial.read() == 'c') {
+    LidarStorage::clear();
+    Serial.println("Cleared, the next boot addresses the lasers one by one");
+  }
+}
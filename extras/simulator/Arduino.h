@@ -0,0 +1,160 @@
+#ifndef SIMULATOR_ARDUINO_H
+#define SIMULATOR_ARDUINO_H
+
+/*******************************************************************************
+  Desktop replacement of the Arduino core, used to run the library against the
+  simulated lasers of LidarSim.h (see README.md)
+
+  The time is simulated: micros() only moves when the simulated I2C bus works,
+  when the clock is read or when sim::advance() is called, so every run is
+  reproducible.
+*******************************************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#define ARDUINO                   10800
+#ifndef F_CPU
+#define F_CPU                     16000000UL
+#endif
+
+#define HIGH                      0x1
+#define LOW                       0x0
+#define INPUT                     0x0
+#define OUTPUT                    0x1
+#define INPUT_PULLUP              0x2
+#define CHANGE                    1
+#define FALLING                   2
+#define RISING                    3
+#define DEC                       10
+#define HEX                       16
+// Pins of Wire, apart from the pins of the examples
+#define SDA                       26
+#define SCL                       27
+#define PIN_WIRE_SDA              SDA
+#define PIN_WIRE_SCL              SCL
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define digitalPinToInterrupt(p) (p)
+
+namespace sim {
+  // Simulated time in ns
+  extern uint64_t nanos;
+  inline void advance(uint64_t ns) { nanos += ns; }
+  // Simulated cost of a micros() or millis() call (ns), so that polling the
+  // clock alone moves the time forward
+  extern uint32_t clockOverhead;
+  // Hooks of the digital pins, set by the simulated bus (LidarSim.h)
+  extern void (*pinWrite)(uint8_t pin, uint8_t value);
+  extern int (*pinRead)(uint8_t pin);
+  extern void (*pinSetMode)(uint8_t pin, uint8_t mode);
+}
+
+inline unsigned long micros() { sim::advance(sim::clockOverhead); return (unsigned long) (sim::nanos / 1000); }
+inline unsigned long millis() { sim::advance(sim::clockOverhead); return (unsigned long) (sim::nanos / 1000000); }
+inline void delay(unsigned long ms) { sim::advance((uint64_t) ms * 1000000); }
+inline void delayMicroseconds(unsigned int us) { sim::advance((uint64_t) us * 1000); }
+inline void noInterrupts() {}
+inline void interrupts() {}
+inline void pinMode(uint8_t pin, uint8_t mode) { if (sim::pinSetMode) sim::pinSetMode(pin, mode); }
+inline void digitalWrite(uint8_t pin, uint8_t value) { if (sim::pinWrite) sim::pinWrite(pin, value); }
+inline int digitalRead(uint8_t pin) { return sim::pinRead ? sim::pinRead(pin) : LOW; }
+inline void attachInterrupt(uint8_t, void (*)(void), int) {}
+inline void detachInterrupt(uint8_t) {}
+
+/*******************************************************************************
+  Print : text output, Serial prints on stdout
+*******************************************************************************/
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t * buffer, size_t size) {
+      size_t n = 0;
+      while (size--)
+        n += write(*buffer++);
+      return n;
+    }
+    virtual int availableForWrite() { return 64; }
+    size_t print(const char * s) { return write((const uint8_t *) s, strlen(s)); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(int n, int base = DEC) { return print((long) n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long) n, base); }
+    size_t print(long n, int base = DEC) {
+      if (n < 0 and base == DEC)
+        return print('-') + print((unsigned long) -n, base);
+      return print((unsigned long) n, base);
+    }
+    size_t print(unsigned long n, int base = DEC) {
+      char buffer[sizeof(unsigned long) * 8 + 1];
+      char * s = &buffer[sizeof(buffer) - 1];
+      *s = 0;
+      do {
+        uint8_t digit = n % base;
+        *--s = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        n /= base;
+      } while (n);
+      return print(s);
+    }
+    size_t print(double n, int digits = 2) {
+      size_t size = 0;
+      if (n < 0) {
+        size += print('-');
+        n = -n;
+      }
+      double rounding = 0.5;
+      for (int i = 0; i < digits; i++)
+        rounding /= 10.0;
+      n += rounding;
+      unsigned long integer = (unsigned long) n;
+      size += print(integer);
+      if (digits > 0)
+        size += print('.');
+      double remainder = n - integer;
+      while (digits-- > 0) {
+        remainder *= 10.0;
+        int digit = (int) remainder;
+        size += print((unsigned long) digit);
+        remainder -= digit;
+      }
+      return size;
+    }
+    size_t println() { return print('\n'); }
+    template <class T> size_t println(T value) { return print(value) + println(); }
+    template <class T> size_t println(T value, int format) { return print(value, format) + println(); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c);
+    using Print::write;
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SIMULATOR_EEPROM_H
+#define SIMULATOR_EEPROM_H
+
+#include <Arduino.h>
+
+/*******************************************************************************
+  EEPROMClass : the AVR EEPROM library in RAM, erased (0xff) at start
+
+  writes counts the byte writes, to check the wear of the code under test.
+*******************************************************************************/
+class EEPROMClass {
+  public:
+    EEPROMClass() { erase(); }
+    uint8_t read(int at) { return at >= 0 and at < size ? memory[at] : 0xff; }
+    void write(int at, uint8_t value) {
+      if (at >= 0 and at < size) {
+        memory[at] = value;
+        writes++;
+      }
+    }
+    void update(int at, uint8_t value) {
+      if (read(at) != value)
+        write(at, value);
+    }
+    uint16_t length() { return size; }
+    void erase() { memset(memory, 0xff, sizeof(memory)); }
+
+    uint32_t writes = 0;
+
+  private:
+    static const int size = 1024;
+    uint8_t memory[size];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
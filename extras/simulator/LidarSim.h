@@ -0,0 +1,443 @@
+#ifndef LIDAR_SIM_H
+#define LIDAR_SIM_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+/*******************************************************************************
+  LidarSim : register model of a LidarLite v2/v3 on a simulated I2C bus
+
+  Modelled: power (enable pin) and boot time, the default address 0x62 and
+  the serial-gated secondary address (0x18, 0x19, 0x1a, 0x1e), the register
+  pointer with auto-increment (bit 7), the acquisition time from
+  REG_SIG_CONT_VAL and the bias correction, free running (0x11 = 0xff), the
+  velocity register, the status output on the mode pin, the trigger by a
+  falling edge on the mode pin (triggerPin, PWM mode), the PWM output (10µs
+  per cm on the mode pin, continuous while the trigger is low), the power control
+  (0x65: no signal with the receiver off, the device sleep NACKs the
+  transaction that wakes it up), NACK injection and the bus lockup (a laser
+  holding SDA low after a power up, released by a few SCL clocks).
+  Several lasers answering the same address read as a wired AND.
+*******************************************************************************/
+namespace sim {
+
+  // Deterministic pseudo random numbers (xorshift32)
+  extern uint32_t seed;
+  inline uint32_t random32() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  }
+  // true with a probability of rate
+  inline bool chance(double rate) {
+    return rate > 0 and random32() < rate * 4294967295.0;
+  }
+
+  // Simulated cost of the Wire library per transaction (ns)
+  extern uint32_t transactionOverhead;
+
+  class Lidar {
+    public:
+      Lidar(uint8_t _enablePin = 12, uint8_t _modePin = 13, uint16_t _serial = 0x1234) :
+        enablePin(_enablePin), modePin(_modePin), serial(_serial) {
+        defaults();
+      }
+
+      // Configuration of the model
+      uint8_t enablePin;
+      uint8_t modePin;
+      uint8_t triggerPin = 0xff;      // Pin driving the mode pin (through 1k), none by default
+      uint16_t serial;
+      uint8_t hardware = 0x15;        // REG_HARDWARE_VERSION (0x41), 0x15 = v2
+      int16_t target = 150;           // Distance of the target (cm)
+      int16_t targetSpeed = 0;        // cm/s, moves the target
+      uint8_t noise = 1;              // Uniform noise of the measure (± cm)
+      uint8_t signal = 120;           // Signal strength of the target
+      double nackRate = 0;            // Probability of a NACK per transaction
+      double outlierRate = 0;         // Probability of an out of range measure
+      double lockupRate = 0;          // Probability of holding SDA low after a power up
+      uint32_t bootTime = 16000;      // µs between power up (or reset) and the first answer
+      uint32_t acquisitionBase = 150; // µs of an acquisition without a count
+      uint32_t acquisitionCount = 4;  // µs per REG_SIG_CONT_VAL count
+      uint32_t biasTime = 300;        // µs added by the bias correction
+
+      // Statistics of the model
+      uint32_t measures = 0;          // Acquisitions done
+      uint32_t reads = 0;             // Distances read
+      uint32_t nacks = 0;             // NACKs injected
+      uint32_t darkMeasures = 0;      // Acquisitions with the receiver off
+      uint32_t powerCycles = 0;
+      uint32_t lockups = 0;           // Lockups of the bus injected
+
+      void defaults() {
+        memset(registers, 0, sizeof(registers));
+        registers[0x02] = 0x80;
+        registers[0x04] = 0x08;
+        registers[0x11] = 0x00;
+        registers[0x12] = 0x05;
+        registers[0x45] = 0x14;
+        registers[0x65] = 0x80;
+        registers[0x16] = serial >> 8;
+        registers[0x17] = serial & 0xff;
+        registers[0x41] = hardware;
+        secondary = 0;
+        latched = 0;
+        pointer = 0;
+        busyUntil = 0;
+        pending = false;
+        waiting = false;
+        freeRunning = false;
+        continuous = false;
+        pulseStart = 0;
+        pulseEnd = 0;
+      }
+
+      // Enable pin
+      void power(bool on) {
+        if (on == powered)
+          return;
+        powered = on;
+        lockupClocks = 0;
+        if (on) {
+          powerCycles++;
+          boot();
+          if (chance(lockupRate)) {
+            lockups++;
+            lockupClocks = 1 + random32() % 8;
+          }
+        }
+      }
+
+      // Holding SDA low, until lockupClocks SCL clocks
+      bool holdsSDA() {
+        return lockupClocks > 0;
+      }
+
+      void clock() {
+        if (lockupClocks)
+          lockupClocks--;
+      }
+
+      bool answers(uint8_t address) {
+        update();
+        if (!powered or micros() < readyAt)
+          return false;
+        if (registers[0x65] & 0x04) {
+          // Device sleep, this transaction wakes it up
+          registers[0x65] &= ~0x04;
+          return false;
+        }
+        if (secondary and address == secondary)
+          return true;
+        return address == 0x62 and !(registers[0x1e] & 0x08);
+      }
+
+      // Trigger pin, a falling edge starts an acquisition in PWM mode, the
+      // next ones follow the pulses while it stays low
+      void triggerInput(bool high) {
+        update();
+        bool falling = triggerHigh and !high;
+        triggerHigh = high;
+        continuous = false;
+        if (falling and powered and micros() >= readyAt and pwmMode()) {
+          trigger(true);
+          continuous = true;
+        }
+      }
+
+      bool busy() {
+        update();
+        return pending;
+      }
+
+      // Mode pin, high while busy in status output mode, the pulse of the
+      // last measure in PWM mode
+      int modeOutput() {
+        if (!powered)
+          return LOW;
+        if (pwmMode()) {
+          update();
+          unsigned long now = micros();
+          return (long) (now - pulseStart) >= 0 and (long) (now - pulseEnd) < 0 ? HIGH : LOW;
+        }
+        if ((registers[0x04] & 0x03) != 0x01)
+          return LOW;
+        return busy() ? HIGH : LOW;
+      }
+
+      void setPointer(uint8_t reg) {
+        pointer = reg;
+      }
+
+      void write(uint8_t reg, uint8_t value) {
+        update();
+        reg &= 0x7f;
+        switch (reg) {
+          case 0x00:
+            if (value == 0x00) {
+              boot();
+              return;
+            }
+            if (value == 0x03 or value == 0x04)
+              trigger(value == 0x04);
+            break;
+          case 0x1a:
+            // Only the laser whose serial was written takes the address
+            if (((registers[0x18] << 8) | registers[0x19]) == serial)
+              latched = value;
+            break;
+          case 0x1e:
+            // The latched address is only answered once 0x1e is written
+            if (latched)
+              secondary = latched;
+            break;
+          case 0x16:
+          case 0x17:
+          case 0x41:
+            return; // Read only
+        }
+        registers[reg] = value;
+      }
+
+      uint8_t read() {
+        update();
+        uint8_t reg = pointer & 0x7f;
+        if (reg == 0x01)
+          registers[0x01] = (pending ? 0x01 : 0x00) | status;
+        if (reg == 0x10)
+          reads++;
+        // Auto-increment when the bit 7 of the register pointer is set
+        if (pointer & 0x80)
+          pointer = 0x80 | ((reg + 1) & 0x7f);
+        return registers[reg];
+      }
+
+    private:
+      void boot() {
+        defaults();
+        readyAt = micros() + bootTime;
+      }
+
+      uint32_t acquisitionTime(bool bias) {
+        return acquisitionBase + acquisitionCount * registers[0x02] + (bias ? biasTime : 0);
+      }
+
+      bool pwmMode() {
+        return (registers[0x04] & 0x03) == 0x00;
+      }
+
+      uint32_t period() {
+        // REG_MEASURE_DELAY with the bit 5 of REG_ACQ_CONFIG, 10ms otherwise
+        return registers[0x04] & 0x20 ? registers[0x45] * 500UL : 10000;
+      }
+
+      void trigger(bool bias) {
+        pending = true;
+        waiting = false;
+        lastBias = bias;
+        startTime = micros();
+        busyUntil = startTime + acquisitionTime(bias);
+        freeRunning = registers[0x11] == 0xff;
+      }
+
+      // Commit the acquisitions finished at this time, and start the next ones
+      // of a free running laser
+      void update() {
+        unsigned long now = micros();
+        while (true) {
+          if (pending and (long) (now - busyUntil) >= 0) {
+            pending = false;
+            measure();
+            if (freeRunning) {
+              startTime += period();
+              waiting = true;
+            }
+          } else if (waiting and (long) (now - startTime) >= 0) {
+            waiting = false;
+            pending = true;
+            busyUntil = startTime + acquisitionTime(lastBias);
+          } else if (continuous and !pending and pwmMode() and (long) (now - pulseEnd) >= 0) {
+            // Trigger held low, the next acquisition starts after the pulse
+            pending = true;
+            startTime = pulseEnd;
+            busyUntil = startTime + acquisitionTime(false);
+          } else {
+            break;
+          }
+        }
+      }
+
+      void measure() {
+        measures++;
+        status = 0x20; // Health flag
+        if (registers[0x65] & 0x01) {
+          // Receiver off, no signal
+          darkMeasures++;
+          status |= 0x08;
+          registers[0x0e] = 0;
+          registers[0x0f] = 0;
+          registers[0x10] = 1;
+          return;
+        }
+        int16_t distance = target + (int32_t) targetSpeed * (int32_t) (busyUntil / 1000) / 1000;
+        if (noise)
+          distance += (int16_t) (random32() % (2 * noise + 1)) - noise;
+        if (chance(outlierRate))
+          distance = random32() % 4000;
+        int16_t last = (registers[0x0f] << 8) | registers[0x10];
+        registers[0x09] = (uint8_t) (int8_t) constrain(distance - last, -128, 127);
+        registers[0x0e] = signal;
+        registers[0x0f] = distance >> 8;
+        registers[0x10] = distance & 0xff;
+        pulseStart = busyUntil;
+        pulseEnd = busyUntil + 10UL * (distance > 0 ? distance : 0);
+      }
+
+      bool powered = false;
+      bool triggerHigh = true;
+      unsigned long readyAt = 0;
+      uint8_t registers[128];
+      uint8_t secondary = 0;
+      uint8_t latched = 0;        // Written to 0x1a, not enabled yet
+      uint8_t pointer = 0;
+      uint8_t status = 0x20;          // Flags of REG_STATUS but the busy flag
+      bool pending = false;
+      bool lastBias = true;
+      bool freeRunning = false;
+      bool waiting = false;
+      unsigned long startTime = 0;
+      unsigned long busyUntil = 0;
+      bool continuous = false;        // PWM, trigger held low since its falling edge
+      unsigned long pulseStart = 0;
+      unsigned long pulseEnd = 0;
+      uint8_t lockupClocks = 0;
+
+      friend class Bus;
+  };
+
+  /*****************************************************************************
+    Bus : the lasers on one I2C bus, and the pins they are connected to
+  *****************************************************************************/
+  class Bus {
+    public:
+      void add(Lidar * lidar) {
+        if (count < maxLidars)
+          lidars[count++] = lidar;
+      }
+
+      void clear() {
+        count = 0;
+        for (uint8_t p = 0; p < 2; p++) {
+          lineOutput[p] = false;
+          lineLow[p] = false;
+        }
+      }
+
+      // A laser holds SDA low, every transaction times out
+      bool stuck() {
+        for (uint8_t i = 0; i < count; i++) {
+          if (lidars[i]->holdsSDA())
+            return true;
+        }
+        return false;
+      }
+
+      // Register pointer write (n = 1) or register write (n = 2), returns the
+      // endTransmission code
+      uint8_t transmit(uint8_t address, const uint8_t * data, uint8_t n) {
+        bool acked = false;
+        for (uint8_t i = 0; i < count; i++) {
+          if (!lidars[i]->answers(address))
+            continue;
+          if (chance(lidars[i]->nackRate)) {
+            lidars[i]->nacks++;
+            return n ? 3 : 2;
+          }
+          acked = true;
+          if (n >= 1)
+            lidars[i]->setPointer(data[0]);
+          for (uint8_t b = 1; b < n; b++)
+            lidars[i]->write((data[0] + b - 1) & 0x7f, data[b]);
+        }
+        return acked ? 0 : 2;
+      }
+
+      // Read n bytes at the register pointer, returns the number of bytes read
+      uint8_t request(uint8_t address, uint8_t * data, uint8_t n) {
+        bool acked = false;
+        memset(data, 0xff, n);
+        for (uint8_t i = 0; i < count; i++) {
+          if (!lidars[i]->answers(address))
+            continue;
+          if (chance(lidars[i]->nackRate)) {
+            lidars[i]->nacks++;
+            continue;
+          }
+          acked = true;
+          // Open drain bus, several lasers read as a wired AND
+          for (uint8_t b = 0; b < n; b++)
+            data[b] &= lidars[i]->read();
+        }
+        return acked ? n : 0;
+      }
+
+      void pinWrite(uint8_t pin, uint8_t value) {
+        if (pin == SDA or pin == SCL) {
+          driveLine(pin == SCL, lineOutput[pin == SCL], value == LOW);
+          return;
+        }
+        for (uint8_t i = 0; i < count; i++) {
+          if (lidars[i]->enablePin == pin)
+            lidars[i]->power(value == HIGH);
+          if (lidars[i]->triggerPin == pin)
+            lidars[i]->triggerInput(value == HIGH);
+        }
+      }
+
+      // SDA and SCL are open drain, low if driven low (OUTPUT and LOW), SDA
+      // also if a laser holds it
+      void pinMode(uint8_t pin, uint8_t mode) {
+        if (pin == SDA or pin == SCL)
+          driveLine(pin == SCL, mode == OUTPUT, lineLow[pin == SCL]);
+      }
+
+      int pinRead(uint8_t pin) {
+        if (pin == SDA)
+          return (lineOutput[0] and lineLow[0]) or stuck() ? LOW : HIGH;
+        if (pin == SCL)
+          return lineOutput[1] and lineLow[1] ? LOW : HIGH;
+        for (uint8_t i = 0; i < count; i++) {
+          if (lidars[i]->modePin == pin)
+            return lidars[i]->modeOutput();
+        }
+        return LOW;
+      }
+
+    private:
+      // Line 0 is SDA, 1 is SCL, a falling SCL clocks the lasers
+      void driveLine(uint8_t line, bool output, bool low) {
+        bool falling = output and low and !(lineOutput[line] and lineLow[line]);
+        lineOutput[line] = output;
+        lineLow[line] = low;
+        if (falling and line == 1) {
+          for (uint8_t i = 0; i < count; i++)
+            lidars[i]->clock();
+        }
+      }
+
+      bool lineOutput[2] = {false, false};
+      bool lineLow[2] = {false, false};
+      static const uint8_t maxLidars = 16;
+      Lidar * lidars[maxLidars];
+      uint8_t count = 0;
+  };
+
+  // Bus of Wire, its pins are the digital pins of the board
+  extern Bus bus;
+
+  // Start a new simulation: time 0, no laser, seed
+  void reset(uint32_t _seed = 1);
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <Arduino.h>
+#include <Wire.h>
+#include <EEPROM.h>
+#include "LidarSim.h"
+
+namespace sim {
+  uint64_t nanos = 0;
+  uint32_t seed = 1;
+  uint32_t transactionOverhead = 10000;
+  uint32_t clockOverhead = 1000;
+  Bus bus;
+
+  static void busPinWrite(uint8_t pin, uint8_t value) { bus.pinWrite(pin, value); }
+  static int busPinRead(uint8_t pin) { return bus.pinRead(pin); }
+  static void busPinMode(uint8_t pin, uint8_t mode) { bus.pinMode(pin, mode); }
+  void (*pinWrite)(uint8_t pin, uint8_t value) = &busPinWrite;
+  int (*pinRead)(uint8_t pin) = &busPinRead;
+  void (*pinSetMode)(uint8_t pin, uint8_t mode) = &busPinMode;
+
+  void reset(uint32_t _seed) {
+    nanos = 0;
+    seed = _seed ? _seed : 1;
+    bus.clear();
+  }
+}
+
+HardwareSerial Serial;
+TwoWire Wire(&sim::bus);
+EEPROMClass EEPROM;
+
+size_t HardwareSerial::write(uint8_t c) {
+  return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+/*******************************************************************************
+  Bus timing : start + address + ack (10 bits), 9 bits per byte, stop (1 bit)
+*******************************************************************************/
+void TwoWire::spend(uint16_t bits) {
+  sim::advance(sim::transactionOverhead + (uint64_t) bits * 1000000000ULL / frequency);
+}
+
+bool TwoWire::stuck() {
+  if (!bus or !bus->stuck())
+    return false;
+  sim::advance((uint64_t) (timeout ? timeout : 1000000UL) * 1000);
+  timeoutFlag = true;
+  return true;
+}
+
+uint8_t TwoWire::endTransmission(bool) {
+  if (stuck()) {
+    txLength = 0;
+    return 5;
+  }
+  uint8_t error = bus ? bus->transmit(txAddress, txBuffer, txLength) : 4;
+  spend(11 + 9 * txLength);
+  txLength = 0;
+  return error;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t) {
+  if (quantity > BUFFER_LENGTH)
+    quantity = BUFFER_LENGTH;
+  rxIndex = 0;
+  if (stuck()) {
+    rxLength = 0;
+    return 0;
+  }
+  rxLength = bus ? bus->request(address, rxBuffer, quantity) : 0;
+  spend(11 + 9 * quantity);
+  return rxLength;
+}
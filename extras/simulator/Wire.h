@@ -0,0 +1,72 @@
+#ifndef SIMULATOR_WIRE_H
+#define SIMULATOR_WIRE_H
+
+#include <Arduino.h>
+
+#define BUFFER_LENGTH             32
+// Transactions bounded by setWireTimeout, as the AVR core
+#define WIRE_HAS_TIMEOUT
+
+namespace sim {
+  class Bus;
+}
+
+/*******************************************************************************
+  TwoWire : the Wire API on top of a simulated bus (sim::Bus, LidarSim.h)
+
+  Each transaction takes the simulated time of its bits at the bus clock, so
+  micros() measures the bus cost of the code under test. On a stuck bus (a
+  laser holding SDA low) it takes the timeout and returns 5, without a
+  timeout it hangs for a second (forever on a board).
+*******************************************************************************/
+class TwoWire : public Stream {
+  public:
+    TwoWire(sim::Bus * _bus = NULL) : bus(_bus) {}
+    void attach(sim::Bus * _bus) { bus = _bus; }
+    void begin() {}
+    void end() {}
+    void setClock(uint32_t clock) { frequency = clock; }
+    uint32_t getClock() { return frequency; }
+    void setWireTimeout(uint32_t _timeout = 25000, bool = false) { timeout = _timeout; }
+    bool getWireTimeoutFlag() { return timeoutFlag; }
+    void clearWireTimeoutFlag() { timeoutFlag = false; }
+
+    void beginTransmission(uint8_t address) {
+      txAddress = address;
+      txLength = 0;
+    }
+    uint8_t endTransmission(bool stop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t stop = 1);
+
+    size_t write(uint8_t data) {
+      if (txLength >= BUFFER_LENGTH)
+        return 0;
+      txBuffer[txLength++] = data;
+      return 1;
+    }
+    using Print::write;
+    int available() { return rxLength - rxIndex; }
+    int read() { return rxIndex < rxLength ? rxBuffer[rxIndex++] : -1; }
+    int peek() { return rxIndex < rxLength ? rxBuffer[rxIndex] : -1; }
+
+  private:
+    // Simulated time of n bits at the bus clock
+    void spend(uint16_t bits);
+    // A transaction on a stuck bus, true if it timed out
+    bool stuck();
+
+    sim::Bus * bus;
+    uint32_t frequency = 100000;
+    uint32_t timeout = 0;           // µs, 0 waits forever
+    bool timeoutFlag = false;
+    uint8_t txAddress = 0;
+    uint8_t txBuffer[BUFFER_LENGTH];
+    uint8_t txLength = 0;
+    uint8_t rxBuffer[BUFFER_LENGTH];
+    uint8_t rxLength = 0;
+    uint8_t rxIndex = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
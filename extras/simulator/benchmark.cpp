@@ -0,0 +1,151 @@
+/*******************************************************************************
+  Benchmark of LidarController::spinOnce() against simulated lasers
+
+  For 1 to MAX_LIDARS lasers, runs the controller for a simulated time and
+  reports the samples per second and the cost of a spin. The time is
+  simulated (I2C bits at the bus clock plus a cost per transaction and per
+  loop), so two runs with the same options give the same numbers.
+
+  ./benchmark [-c clock_kHz] [-t seconds] [-n nack_rate] [-o outlier_rate]
+              [-k lockup_rate] [-l loop_us] [-s seed] [-p] [-y]
+
+  -k : probability that a laser holds SDA low after a power up, counts the
+       bus clears
+
+  -p : use the mode pin (status output mode) instead of the status register
+  -y : trigger the lasers together (synchronize()), counts the frames
+*******************************************************************************/
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include "LidarSim.h"
+
+#define ENABLE_STATISTICS true
+#include "LidarController.h"
+
+// Pins and addresses of the examples
+static const uint8_t enablePins[MAX_LIDARS] = {12, 9, 6, 3, 15, 18, 21, 24};
+static const uint8_t modePins[MAX_LIDARS] = {13, 10, 7, 4, 14, 17, 20, 23};
+static const uint8_t triggerPins[MAX_LIDARS] = {11, 8, 5, 2, 16, 19, 22, 25};
+
+struct Options {
+  unsigned long clock = 400;  // kHz
+  double seconds = 2;         // Measured time, after one second of warm up
+  double nackRate = 0;
+  double outlierRate = 0;
+  double lockupRate = 0;
+  unsigned long loop = 10;    // µs spent by the rest of loop() per spin
+  uint32_t seed = 1;
+  bool statusPin = false;
+  bool synchronized = false;
+};
+
+struct Result {
+  double sampleRate;          // Samples per second, all lasers
+  double spinCost;            // Average simulated µs per spinOnce()
+  unsigned long spinMax;      // Longest spinOnce() (µs)
+  double hostCost;            // Average host ns per spinOnce()
+  uint32_t recoveries;
+  uint32_t nacks;
+  double frameRate;           // Frames per second of the synchronized group
+  uint32_t clears;            // Bus clears (I2C.statistics.clears)
+};
+
+static Result run(uint8_t lasers, const Options & options) {
+  sim::reset(options.seed);
+  static sim::Lidar models[MAX_LIDARS];
+  static LidarObject objects[MAX_LIDARS];
+  LidarController controller;
+
+  for (uint8_t i = 0; i < lasers; i++) {
+    models[i] = sim::Lidar(enablePins[i], modePins[i], 0x1000 + i);
+    models[i].target = 100 + 50 * i;
+    models[i].nackRate = options.nackRate;
+    models[i].outlierRate = options.outlierRate;
+    models[i].lockupRate = options.lockupRate;
+    models[i].triggerPin = triggerPins[i];
+    sim::bus.add(&models[i]);
+    objects[i] = LidarObject();
+    objects[i].begin(enablePins[i], modePins[i], triggerPins[i], 0x64 + 2 * i, 2, DISTANCE, 'a' + i);
+    if (options.statusPin)
+      objects[i].beginStatusPin();
+  }
+  controller.begin(options.clock >= 400);
+  Wire.setClock(options.clock * 1000UL);
+  for (uint8_t i = 0; i < lasers; i++) {
+    controller.add(&objects[i], i);
+    if (options.synchronized)
+      controller.synchronize(i);
+  }
+
+  // Warm up: reset and address every laser
+  while (micros() < 1000000UL) {
+    controller.spinOnce();
+    sim::advance(options.loop * 1000);
+  }
+  controller.resetStatistics();
+
+  unsigned long end = micros() + (unsigned long) (options.seconds * 1000000);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  uint32_t frames = 0;
+  while ((long) (micros() - end) < 0) {
+    controller.spinOnce();
+    frames += controller.syncFrame();
+    sim::advance(options.loop * 1000);
+  }
+  double host = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  Result result = {};
+  uint32_t samples = 0;
+  for (uint8_t i = 0; i < lasers; i++) {
+    samples += controller.lidarStatistics[i].samples;
+    result.recoveries += controller.lidarStatistics[i].recoveries;
+    result.nacks += models[i].nacks;
+  }
+  result.sampleRate = samples / options.seconds;
+  result.frameRate = frames / options.seconds;
+  result.clears = I2C.statistics.clears;
+  result.spinCost = controller.spinStatistics.count ? (double) controller.spinStatistics.total / controller.spinStatistics.count : 0;
+  result.spinMax = controller.spinStatistics.max;
+  result.hostCost = controller.spinStatistics.count ? host / controller.spinStatistics.count : 0;
+  return result;
+}
+
+int main(int argc, char ** argv) {
+  Options options;
+  int option;
+  while ((option = getopt(argc, argv, "c:t:n:o:k:l:s:py")) != -1) {
+    switch (option) {
+      case 'c': options.clock = strtoul(optarg, NULL, 10); break;
+      case 't': options.seconds = atof(optarg); break;
+      case 'n': options.nackRate = atof(optarg); break;
+      case 'o': options.outlierRate = atof(optarg); break;
+      case 'k': options.lockupRate = atof(optarg); break;
+      case 'l': options.loop = strtoul(optarg, NULL, 10); break;
+      case 's': options.seed = strtoul(optarg, NULL, 10); break;
+      case 'p': options.statusPin = true; break;
+      case 'y': options.synchronized = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-c clock_kHz] [-t seconds] [-n nack_rate] [-o outlier_rate] [-k lockup_rate] [-l loop_us] [-s seed] [-p] [-y]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  printf("# %lukHz, %.1fs, nack rate %g, outlier rate %g, lockup rate %g, loop %luus, %s, queue %s%s\n",
+    options.clock, options.seconds, options.nackRate, options.outlierRate, options.lockupRate, options.loop,
+    options.statusPin ? "mode pin" : "status register", ENABLE_I2C_QUEUE ? "on" : "off",
+    options.synchronized ? ", synchronized" : "");
+  printf("lasers,samples_per_s,per_laser,spin_us,spin_max_us,host_ns_per_spin,recoveries,nacks%s%s\n",
+    options.synchronized ? ",frames_per_s" : "", options.lockupRate > 0 ? ",bus_clears" : "");
+  for (uint8_t lasers = 1; lasers <= MAX_LIDARS; lasers++) {
+    Result result = run(lasers, options);
+    printf("%u,%.1f,%.1f,%.1f,%lu,%.0f,%u,%u", lasers, result.sampleRate, result.sampleRate / lasers,
+      result.spinCost, result.spinMax, result.hostCost, result.recoveries, result.nacks);
+    if (options.synchronized)
+      printf(",%.1f", result.frameRate);
+    if (options.lockupRate > 0)
+      printf(",%u", result.clears);
+    printf("\n");
+  }
+  return 0;
+}